@@ -0,0 +1,168 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "BaseSoCache.h"
+#include "Hash.h"
+#include "FDebug.h"
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <sys/stat.h>
+
+static bool ReadWholeFile(const char* path, std::vector<uint8_t>& data) {
+    auto fp = fopen(path, "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    auto size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data.resize(size > 0 ? size : 0);
+    auto rc = fread(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    return rc == data.size();
+}
+
+// Copy count items at offset of data, returns false if out of range.
+template <typename T>
+static bool ReadTable(const std::vector<uint8_t>& data, uint64_t offset, size_t count,
+                      std::vector<T>& table) {
+    if (offset > data.size() || count > (data.size() - offset) / sizeof(T)) {
+        return false;
+    }
+    table.resize(count);
+    memcpy(table.data(), data.data() + offset, count * sizeof(T));
+    return true;
+}
+
+std::shared_ptr<const BaseSoInfo> BaseSoInfo::Parse(const char *path) {
+    std::vector<uint8_t> data;
+    if (!ReadWholeFile(path, data)) {
+        FLOGE("unable to read base so file %s", path);
+        return nullptr;
+    }
+    return Parse(data, HashData(data.data(), data.size()));
+}
+
+std::shared_ptr<const BaseSoInfo> BaseSoInfo::Parse(const std::vector<uint8_t> &data, uint64_t hash) {
+    std::shared_ptr<BaseSoInfo> info(new BaseSoInfo);
+    info->hash = hash;
+
+    if (data.size() < sizeof(Elf_Ehdr)) {
+        FLOGE("base so is too small to be an ELF file");
+        return nullptr;
+    }
+    memcpy(&info->ehdr, data.data(), sizeof(Elf_Ehdr));
+    auto& ehdr = info->ehdr;
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0) {
+        FLOGE("base so has bad ELF magic");
+        return nullptr;
+    }
+#ifndef __SO64__
+    if (ehdr.e_ident[EI_CLASS] != ELFCLASS32) {
+#else
+    if (ehdr.e_ident[EI_CLASS] != ELFCLASS64) {
+#endif
+        FLOGE("base so has unexpected elf class: %d", ehdr.e_ident[EI_CLASS]);
+        return nullptr;
+    }
+    if (!ReadTable(data, ehdr.e_phoff, ehdr.e_phnum, info->phdrs)) {
+        FLOGE("base so has no valid phdr data");
+        return nullptr;
+    }
+
+    for (auto& phdr : info->phdrs) {
+        if (phdr.p_type != PT_DYNAMIC) continue;
+        if (!ReadTable(data, phdr.p_offset, phdr.p_filesz / sizeof(Elf_Dyn), info->dynamic)) {
+            FLOGE("base so has no valid dynamic data");
+            return nullptr;
+        }
+        info->dynamic_flags = phdr.p_flags;
+        break;
+    }
+
+    // section headers are optional, a stripped base so is still useful
+    if (ehdr.e_shoff != 0 && ReadTable(data, ehdr.e_shoff, ehdr.e_shnum, info->shdrs)) {
+        for (auto& shdr : info->shdrs) {
+            if (shdr.sh_type != SHT_DYNSYM || shdr.sh_link >= info->shdrs.size()) continue;
+            auto& strtab = info->shdrs[shdr.sh_link];
+            std::vector<char> names;
+            if (ReadTable(data, shdr.sh_offset, shdr.sh_size / sizeof(Elf_Sym), info->symbols) &&
+                ReadTable(data, strtab.sh_offset, strtab.sh_size, names)) {
+                info->symbol_names.assign(names.begin(), names.end());
+            }
+            break;
+        }
+    }
+    return info;
+}
+
+std::shared_ptr<const BaseSoInfo> BaseSoCache::Touch(CachedInfo &cached) {
+    lru_.splice(lru_.begin(), lru_, cached.used);
+    return cached.info;
+}
+
+void BaseSoCache::Insert(uint64_t hash, const std::shared_ptr<const BaseSoInfo> &info) {
+    lru_.push_front(hash);
+    CachedInfo cached = {info, lru_.begin()};
+    infos_[hash] = cached;
+    while (infos_.size() > max_entries_ && !lru_.empty()) {
+        auto dropped = lru_.back();
+        lru_.pop_back();
+        infos_.erase(dropped);
+        for (auto it = stamps_.begin(); it != stamps_.end();) {
+            it = it->second.hash == dropped ? stamps_.erase(it) : std::next(it);
+        }
+    }
+}
+
+std::shared_ptr<const BaseSoInfo> BaseSoCache::Get(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        FLOGE("unable to read base so file %s", path);
+        return nullptr;
+    }
+    // a file rewritten within a second keeps st_mtime, a replaced one gets
+    // another inode
+#ifdef __APPLE__
+    int64_t mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+    int64_t mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+    FileStamp stamp = {(int64_t)st.st_size, (int64_t)st.st_mtime, mtime_nsec,
+                       (uint64_t)st.st_dev, (uint64_t)st.st_ino, 0};
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto known = stamps_.find(path);
+        if (known != stamps_.end() && known->second.Same(stamp)) {
+            auto info = infos_.find(known->second.hash);
+            if (info != infos_.end()) {
+                return Touch(info->second);
+            }
+        }
+    }
+
+    std::vector<uint8_t> data;
+    if (!ReadWholeFile(path, data)) {
+        FLOGE("unable to read base so file %s", path);
+        return nullptr;
+    }
+    auto hash = HashData(data.data(), data.size());
+    stamp.hash = hash;
+    std::lock_guard<std::mutex> guard(lock_);
+    auto info = infos_.find(hash);
+    if (info != infos_.end()) {
+        stamps_[path] = stamp;
+        return Touch(info->second);
+    }
+    // parsing is cheap compared with reading, keep lock to parse only once
+    auto parsed = BaseSoInfo::Parse(data, hash);
+    if (parsed != nullptr) {
+        FLOGD("base so %s is cached as %s", path, HashToString(hash).c_str());
+        Insert(hash, parsed);
+        stamps_[path] = stamp;
+    }
+    return parsed;
+}
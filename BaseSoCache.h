@@ -0,0 +1,81 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Parsed information of the original so file(-b), shared between jobs
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_BASESOCACHE_H
+#define SOFIXER_BASESOCACHE_H
+
+#include "macros.h"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct BaseSoInfo {
+    // content hash of base so file
+    uint64_t hash = 0;
+
+    Elf_Ehdr ehdr;
+    std::vector<Elf_Phdr> phdrs;
+    std::vector<Elf_Shdr> shdrs;
+
+    // PT_DYNAMIC data
+    std::vector<Elf_Dyn> dynamic;
+    Elf_Word dynamic_flags = 0;
+
+    // .dynsym and the string table linked to it
+    std::vector<Elf_Sym> symbols;
+    std::string symbol_names;
+
+    // Parse the base so file, returns nullptr on error.
+    static std::shared_ptr<const BaseSoInfo> Parse(const char* path);
+    static std::shared_ptr<const BaseSoInfo> Parse(const std::vector<uint8_t>& data, uint64_t hash);
+};
+
+// Base so files keyed by their content hash. Parsed information is read only
+// and shared by concurrent jobs. At most max_entries files are kept, the
+// least recently used one is dropped first.
+class BaseSoCache {
+public:
+    explicit BaseSoCache(size_t max_entries = 64) : max_entries_(max_entries) {}
+
+    std::shared_ptr<const BaseSoInfo> Get(const char* path);
+
+private:
+    struct FileStamp {
+        int64_t size;
+        int64_t mtime;
+        int64_t mtime_nsec;
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t hash;
+
+        bool Same(const FileStamp& other) const {
+            return size == other.size && mtime == other.mtime && mtime_nsec == other.mtime_nsec &&
+                   dev == other.dev && ino == other.ino;
+        }
+    };
+    struct CachedInfo {
+        std::shared_ptr<const BaseSoInfo> info;
+        // position in lru_
+        std::list<uint64_t>::iterator used;
+    };
+    // mark info as the most recently used one
+    std::shared_ptr<const BaseSoInfo> Touch(CachedInfo& cached);
+    void Insert(uint64_t hash, const std::shared_ptr<const BaseSoInfo>& info);
+
+    size_t max_entries_;
+    std::mutex lock_;
+    std::map<uint64_t, CachedInfo> infos_;
+    // hashes of infos_, the most recently used first
+    std::list<uint64_t> lru_;
+    // avoid hashing the same unchanged file again, only files in infos_
+    std::map<std::string, FileStamp> stamps_;
+};
+
+
+#endif //SOFIXER_BASESOCACHE_H
@@ -0,0 +1,276 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "Batch.h"
+#include "FDebug.h"
+#include "BoundedQueue.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <fstream>
+#include <dirent.h>
+#include <sys/stat.h>
+
+BatchRunner::BatchRunner(const FixOptions &defaults, unsigned worker_count)
+        : defaults_(defaults), worker_count_(worker_count) {
+    defaults_.baseso_cache = &baseso_cache_;
+    defaults_.image_pool = &image_pool_;
+    image_pool_.setHugePages(defaults_.huge_pages);
+    if (worker_count_ == 0) {
+        worker_count_ = std::thread::hardware_concurrency();
+    }
+    if (worker_count_ == 0) {
+        worker_count_ = 1;
+    }
+}
+
+bool BatchRunner::LoadManifest(const char *path) {
+    std::ifstream manifest(path);
+    if (!manifest) {
+        FLOGE("unable to open manifest file %s", path);
+        return false;
+    }
+    std::string line;
+    size_t line_num = 0;
+    while (std::getline(manifest, line)) {
+        line_num++;
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        FixOptions job = defaults_;
+        if (!ParseFixJob(line, &job)) {
+            FLOGE("%s:%zu: output path is missing", path, line_num);
+            return false;
+        }
+        jobs_.push_back(job);
+    }
+    return true;
+}
+
+bool BatchRunner::LoadDirectory(const char *dir, const char *output_dir) {
+    auto d = opendir(dir);
+    if (d == nullptr) {
+        FLOGE("unable to open directory %s", dir);
+        return false;
+    }
+    while (auto entry = readdir(d)) {
+        FixOptions job = defaults_;
+        job.source = std::string(dir) + "/" + entry->d_name;
+        struct stat st;
+        if (stat(job.source.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        job.output = std::string(output_dir) + "/" + entry->d_name;
+        jobs_.push_back(job);
+    }
+    closedir(d);
+    return true;
+}
+
+size_t BatchRunner::AdmitJob() {
+    TraceScope wait("wait_admit", "queue");
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!pending_.empty()) {
+        for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+            auto footprint = footprints_[*it];
+            if (memory_budget_ == 0 || running_ == 0 ||
+                memory_in_use_ + footprint <= memory_budget_) {
+                auto job = *it;
+                pending_.erase(it);
+                memory_in_use_ += footprint;
+                running_++;
+                // buffers kept by image pool are in budget too, the ones
+                // that do not fit next to running jobs are dropped
+                auto space = memory_budget_ > memory_in_use_ ? memory_budget_ - memory_in_use_ : 0;
+                guard.unlock();
+                if (memory_budget_ != 0) {
+                    image_pool_.Trim(space);
+                }
+                return job;
+            }
+        }
+        finished_.wait(guard);
+    }
+    return (size_t)-1;
+}
+
+void BatchRunner::FinishJob(size_t job) {
+    std::lock_guard<std::mutex> guard(lock_);
+    memory_in_use_ -= footprints_[job];
+    running_--;
+    finished_.notify_all();
+}
+
+size_t BatchRunner::Run() {
+    // std::vector<bool> can not be written from many threads
+    std::vector<char> results(jobs_.size(), 0);
+    std::atomic<size_t> next_job(0);
+    auto worker_count = std::min<size_t>(worker_count_, jobs_.size());
+    auto run_workers = [&](const std::function<void()>& worker) {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < worker_count; i++) {
+            workers.emplace_back(worker);
+        }
+        for (auto& t : workers) {
+            t.join();
+        }
+    };
+
+    // estimate memory of every job with their phdr table
+    footprints_.assign(jobs_.size(), 0);
+    if (memory_budget_ != 0) {
+        run_workers([&]() {
+            for (auto i = next_job++; i < jobs_.size(); i = next_job++) {
+                footprints_[i] = EstimateFixMemory(jobs_[i]);
+            }
+        });
+    }
+    stats_.clear();
+    if (collect_stats_) {
+        stats_.resize(jobs_.size());
+        for (size_t i = 0; i < jobs_.size(); i++) {
+            stats_[i].source = jobs_[i].source;
+            stats_[i].output = jobs_[i].output;
+            jobs_[i].stats = &stats_[i];
+        }
+    }
+    pending_.clear();
+    for (size_t i = 0; i < jobs_.size(); i++) {
+        pending_.push_back(i);
+    }
+    std::stable_sort(pending_.begin(), pending_.end(), [this](size_t first, size_t second) {
+        return footprints_[first] > footprints_[second];
+    });
+
+    // result cache, incremental re-fix and windows take their own way to output
+    if (defaults_.result_cache == nullptr && defaults_.previous.empty() && !defaults_.save_refix &&
+        defaults_.window_size == 0) {
+        RunPipeline(results);
+    } else {
+        std::atomic<unsigned> next_worker(0);
+        run_workers([&]() {
+            TraceThreadName("worker " + std::to_string(next_worker++));
+            JobArena arena;
+            for (auto i = AdmitJob(); i != (size_t)-1; i = AdmitJob()) {
+                TraceScope span("job", "job", jobs_[i].source);
+                FLogJob log_job(jobs_[i].source);
+                auto job = jobs_[i];
+                job.arena = &arena;
+                results[i] = FixSoFile(job);
+                arena.Reset();
+                FinishJob(i);
+            }
+        });
+    }
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs_.size(); i++) {
+        if (collect_stats_) {
+            stats_[i].ok = results[i] != 0;
+        }
+        if (!results[i]) {
+            FLOGE("failed to fix %s", jobs_[i].source.c_str());
+            failed++;
+        }
+    }
+    FLOGI("%zu jobs done, %zu succeeded, %zu failed", jobs_.size(), jobs_.size() - failed, failed);
+    return failed;
+}
+
+void BatchRunner::RunPipeline(std::vector<char>& results) {
+    auto fix_count = std::min<size_t>(worker_count_, jobs_.size());
+    // reading and writing are bound by disk, a few threads are enough
+    auto io_count = std::min<size_t>(2, fix_count);
+    BoundedQueue<PipelineItem> read_queue(fix_count);
+    BoundedQueue<PipelineItem> write_queue(fix_count);
+
+    auto start_stage = [](size_t count, const char* name, const std::function<void()>& stage) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < count; i++) {
+            auto track = name + std::string(" ") + std::to_string(i);
+            threads.emplace_back([track, stage]() {
+                TraceThreadName(track);
+                stage();
+            });
+        }
+        return threads;
+    };
+    auto push = [](BoundedQueue<PipelineItem>& queue, PipelineItem& item) {
+        TraceScope wait("wait_push", "queue");
+        queue.Push(std::move(item));
+    };
+    auto pop = [](BoundedQueue<PipelineItem>& queue, PipelineItem* item) {
+        TraceScope wait("wait_pop", "queue");
+        return queue.Pop(item);
+    };
+    auto join_stage = [](std::vector<std::thread>& threads, BoundedQueue<PipelineItem>* output) {
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (output != nullptr) {
+            output->Close();
+        }
+    };
+
+    // memory of a job is admitted before reading, and released after writing
+    auto readers = start_stage(io_count, "reader", [&]() {
+        for (auto i = AdmitJob(); i != (size_t)-1; i = AdmitJob()) {
+            PipelineItem item;
+            item.job = i;
+            bool ok;
+            {
+                TraceScope span("job", "job", jobs_[i].source);
+                FLogJob log_job(jobs_[i].source);
+                ok = ReadFixSource(jobs_[i], &item.dump);
+            }
+            if (!ok) {
+                FLOGE("unable to open source file %s", jobs_[i].source.c_str());
+                FinishJob(i);
+                continue;
+            }
+            push(read_queue, item);
+        }
+    });
+    auto fixers = start_stage(fix_count, "fixer", [&]() {
+        PipelineItem item;
+        JobArena arena;
+        while (pop(read_queue, &item)) {
+            auto job = jobs_[item.job];
+            job.arena = &arena;
+            bool ok;
+            {
+                TraceScope span("job", "job", job.source);
+                FLogJob log_job(job.source);
+                ok = FixSoBuffer(item.dump.data(), item.dump.size(), job, &item.output);
+                arena.Reset();
+            }
+            if (!ok) {
+                FinishJob(item.job);
+                continue;
+            }
+            // the dump is no longer needed, release it before waiting for writer
+            std::vector<uint8_t>().swap(item.dump);
+            push(write_queue, item);
+        }
+    });
+    auto writers = start_stage(io_count, "writer", [&]() {
+        PipelineItem item;
+        while (pop(write_queue, &item)) {
+            {
+                TraceScope span("job", "job", jobs_[item.job].source);
+                FLogJob log_job(jobs_[item.job].source);
+                results[item.job] = WriteFixOutput(jobs_[item.job], item.output.data.get(), item.output.size);
+            }
+            item.output = FixBuffer();
+            FinishJob(item.job);
+        }
+    });
+
+    join_stage(readers, &read_queue);
+    join_stage(fixers, &write_queue);
+    join_stage(writers, nullptr);
+}
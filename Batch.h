@@ -0,0 +1,72 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Fix many dumped so files in one process
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_BATCH_H
+#define SOFIXER_BATCH_H
+
+#include "Fixer.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+class BatchRunner {
+public:
+    // options used by jobs that do not set them
+    BatchRunner(const FixOptions& defaults, unsigned worker_count);
+
+    // every line is "source output [memBaseAddr] [baseSoPath]",
+    // empty lines and lines start with '#' are skipped.
+    bool LoadManifest(const char* path);
+    // fix every regular file in dir, and write to output_dir with the same name
+    bool LoadDirectory(const char* dir, const char* output_dir);
+
+    // Jobs are only started while the sum of their estimated memory and the
+    // buffers kept by image pool fits in budget, 0 for no limit. A job larger
+    // than budget is run alone.
+    void setMemoryBudget(size_t budget) { memory_budget_ = budget; }
+    // record stats of every job in Run
+    void setCollectStats(bool collect) { collect_stats_ = collect; }
+    const std::vector<FixStats>& stats() { return stats_; }
+
+    // Returns the count of failed jobs.
+    size_t Run();
+
+private:
+    // a job passed between the stages of the pipeline
+    struct PipelineItem {
+        size_t job;
+        std::vector<uint8_t> dump;
+        FixBuffer output;
+    };
+    // Read, fix and write jobs on separate threads connected by bounded
+    // queues, so that disk and cpu are both kept busy.
+    void RunPipeline(std::vector<char>& results);
+
+    // Returns the next job to run, the largest one that fits in budget.
+    // Blocks until one fits, -1 if all jobs have been started.
+    size_t AdmitJob();
+    void FinishJob(size_t job);
+
+    FixOptions defaults_;
+    BaseSoCache baseso_cache_;
+    ImagePool image_pool_;
+    unsigned worker_count_;
+    size_t memory_budget_ = 0;
+
+    std::mutex lock_;
+    std::condition_variable finished_;
+    // indexes of jobs not started, the largest first
+    std::vector<size_t> pending_;
+    std::vector<size_t> footprints_;
+    size_t memory_in_use_ = 0;
+    size_t running_ = 0;
+
+    std::vector<FixOptions> jobs_;
+    bool collect_stats_ = false;
+    std::vector<FixStats> stats_;
+};
+
+
+#endif //SOFIXER_BATCH_H
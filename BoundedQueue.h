@@ -0,0 +1,56 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Blocking queue with limited capacity, connects the stages of a pipeline
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_BOUNDEDQUEUE_H
+#define SOFIXER_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity == 0 ? 1 : capacity) {}
+
+    // Blocks while the queue is full.
+    void Push(T item) {
+        std::unique_lock<std::mutex> guard(lock_);
+        not_full_.wait(guard, [this]() { return items_.size() < capacity_; });
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+
+    // Blocks while the queue is empty, returns false if it is closed and
+    // all items have been taken.
+    bool Pop(T* item) {
+        std::unique_lock<std::mutex> guard(lock_);
+        not_empty_.wait(guard, [this]() { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return false;
+        }
+        *item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed.
+    void Close() {
+        std::lock_guard<std::mutex> guard(lock_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> items_;
+    std::mutex lock_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+#endif //SOFIXER_BOUNDEDQUEUE_H
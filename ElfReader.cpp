@@ -107,17 +107,22 @@ ElfReader::ElfReader()
 
 ElfReader::~ElfReader() {
     if (phdr_mmap_ != NULL) {
-        delete [](uint8_t*)phdr_mmap_;
+        JobArena::Free(arena_, phdr_mmap_, phdr_size_);
+        TrackAlloc(stats_, "phdr", -(int64_t)phdr_size_);
     }
-    if(load_start_ != nullptr) {
-        delete [](uint8_t*)load_start_;
-    }
-    if (source_ != nullptr) {
-        delete source_;
+    if (load_start_ != nullptr && map_source_) {
+#ifdef SOFIXER_HAVE_FD_READER
+        munmap(load_start_, PAGE_END(load_size_ + pad_size_));
+#endif
+    } else if(load_start_ != nullptr) {
+        ImagePool::Release(image_pool_, load_start_, load_size_ + pad_size_);
+        TrackAlloc(stats_, "load", -(int64_t)(load_size_ + pad_size_));
     }
+    JobArena::Delete(arena_, source_);
 }
 
 bool ElfReader::Load() {
+    PhaseTimer timer(stats_, "load");
     // try open
     return ReadElfHeader() &&
            VerifyElfHeader() &&
@@ -178,6 +183,7 @@ bool ElfReader::VerifyElfHeader() {
 // Loads the program header table from an ELF file into a read-only private
 // anonymous mmap-ed block.
 bool ElfReader::ReadProgramHeader() {
+    PhaseTimer timer(stats_, "read_phdr");
     phdr_num_ = header_.e_phnum;
 
     // Like the kernel, we only accept program header tables that
@@ -188,13 +194,15 @@ bool ElfReader::ReadProgramHeader() {
     }
 
     phdr_size_ = phdr_num_ * sizeof(Elf_Phdr);
-    void* mmap_result = new uint8_t[phdr_size_];
+    void* mmap_result = JobArena::Allocate(arena_, phdr_size_, alignof(Elf_Phdr));
     if(!source_->Read(mmap_result, phdr_size_, header_.e_phoff)) {
         FLOGE("\"%s\" has no valid phdr data", name_);
+        JobArena::Free(arena_, mmap_result, phdr_size_);
         return false;
     }
 
     phdr_mmap_ = mmap_result;
+    TrackAlloc(stats_, "phdr", phdr_size_);
     phdr_table_ = reinterpret_cast<Elf_Phdr*>(reinterpret_cast<char*>(mmap_result));
 
     return true;
@@ -259,6 +267,7 @@ size_t phdr_table_get_load_size(const Elf_Phdr* phdr_table,
 // segments of a program header table. This is done by creating a
 // private anonymous mmap() with PROT_NONE.
 bool ElfReader::ReserveAddressSpace(uint32_t padding_size) {
+    PhaseTimer timer(stats_, "reserve");
     Elf_Addr min_vaddr;
     load_size_ = phdr_table_get_load_size(phdr_table_, phdr_num_, &min_vaddr);
     if (load_size_ == 0) {
@@ -267,11 +276,15 @@ bool ElfReader::ReserveAddressSpace(uint32_t padding_size) {
     }
     pad_size_ = padding_size;
 
-    uint32_t alloc_size = load_size_ + pad_size_;
+    size_t alloc_size = load_size_ + pad_size_;
 
     uint8_t* addr = reinterpret_cast<uint8_t*>(min_vaddr);
+    if (map_source_) {
+        return MapAddressSpace(min_vaddr, alloc_size);
+    }
     // alloc map data, and load in addr
-    uint8_t * start = new uint8_t[alloc_size];
+    uint8_t * start = ImagePool::Acquire(image_pool_, alloc_size);
+    TrackAlloc(stats_, "load", alloc_size);
     memset(start, 0, alloc_size);
 
     load_start_ = start;
@@ -282,11 +295,47 @@ bool ElfReader::ReserveAddressSpace(uint32_t padding_size) {
     return true;
 }
 
+// Map the dump file privately instead of reading it, so pages are read when
+// touched and can be dropped once written out.
+bool ElfReader::MapAddressSpace(Elf_Addr min_vaddr, size_t alloc_size) {
+#ifdef SOFIXER_HAVE_FD_READER
+    // the file is mapped at p_offset of the first segment
+    if (PAGE_OFFSET(min_vaddr) != 0 || min_vaddr >= file_size) {
+        FLOGE("\"%s\" first segment at %llx can not be mapped", name_, (unsigned long long)min_vaddr);
+        return false;
+    }
+    // reserve address space only, what is beyond the file stays zero
+    auto map_size = PAGE_END(alloc_size);
+    auto start = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        FLOGE("unable to reserve %zu bytes for \"%s\": %s", map_size, name_, strerror(errno));
+        return false;
+    }
+    auto file_part = std::min<size_t>(map_size, PAGE_END(file_size - min_vaddr));
+    if (!source_->MapPrivate(start, file_part, min_vaddr)) {
+        munmap(start, map_size);
+        return false;
+    }
+    load_start_ = reinterpret_cast<uint8_t*>(start);
+    load_bias_ = load_start_ - min_vaddr;
+    return true;
+#else
+    FLOGE("mapping source is not supported on this platform");
+    return false;
+#endif
+}
+
 // Map all loadable segments in process' address space.
 // This assumes you already called phdr_table_reserve_memory to
 // reserve the address space range for the library.
 // TODO: assert assumption.
 bool ElfReader::LoadSegments() {
+    PhaseTimer timer(stats_, "load_segments");
+    if (map_source_) {
+        // mapped by MapAddressSpace
+        return true;
+    }
     // TODO fix file dada load error, file data between LOAD seg should be loaded
     for (size_t i = 0; i < phdr_num_; ++i) {
         const Elf_Phdr* phdr = &phdr_table_[i];
@@ -584,6 +633,7 @@ phdr_table_get_dynamic_section(const Elf_Phdr* phdr_table,
 // segments in memory. This is in contrast with 'phdr_table_' which
 // is temporary and will be released before the library is relocated.
 bool ElfReader::FindPhdr() {
+    PhaseTimer timer(stats_, "find_phdr");
     const Elf_Phdr* phdr_limit = phdr_table_ + phdr_num_;
 
     // If there is a PT_PHDR, use it directly.
@@ -642,9 +692,33 @@ void ElfReader::ApplyPhdrTable() {
 
 bool ElfReader::setSource(const char *source) {
     name_ = source;
-    auto fr = new FileReader(source);
+    auto fr = JobArena::New<FileReader>(arena_, source);
+    if (!fr->Open()) {
+        JobArena::Delete(arena_, fr);
+        return false;
+    }
+    file_size = fr->FileSize();
+    source_ = fr;
+    return true;
+}
+
+bool ElfReader::setSource(const char *name, const void *data, size_t size) {
+    name_ = name;
+    auto fr = JobArena::New<FileReader>(arena_, name, data, size);
+    if (!fr->Open()) {
+        JobArena::Delete(arena_, fr);
+        return false;
+    }
+    file_size = fr->FileSize();
+    source_ = fr;
+    return true;
+}
+
+bool ElfReader::setSource(const char *name, int fd) {
+    name_ = name;
+    auto fr = JobArena::New<FileReader>(arena_, name, fd);
     if (!fr->Open()) {
-        delete fr;
+        JobArena::Delete(arena_, fr);
         return false;
     }
     file_size = fr->FileSize();
@@ -11,6 +11,9 @@
 
 #include "macros.h"
 #include "FileReader.h"
+#include "JobArena.h"
+#include "ImagePool.h"
+#include "Stats.h"
 
 #include <cstdint>
 #include <cstddef>
@@ -28,20 +31,40 @@ public:
 
     virtual bool Load();
     bool setSource(const char* source);
+    // read source from file descriptor, name is used in log only
+    bool setSource(const char* name, int fd);
+    // read source from memory, data must be kept until reader is released
+    bool setSource(const char* name, const void* data, size_t size);
 
     size_t phdr_count() { return phdr_num_; }
     uint8_t * load_start() { return load_start_; }
     Elf_Addr load_size() { return load_size_; }
+    size_t source_size() { return file_size; }
     uint8_t * load_bias() { return load_bias_; }
     const Elf_Phdr* loaded_phdr() { return loaded_phdr_; }
 
     const Elf_Ehdr* record_ehdr() { return &header_; }
 
+    // time of load steps is recorded if set
+    void setStats(FixStats* stats) { stats_ = stats; }
+    // source reader and phdr table are allocated from arena if set, it must
+    // be set before setSource
+    void setArena(JobArena* arena) { arena_ = arena; }
+    JobArena* arena() { return arena_; }
+    // loaded image is taken from pool if set
+    void setImagePool(ImagePool* pool) { image_pool_ = pool; }
+    // Map the source to the image instead of reading it, pages are read when
+    // touched and can be dropped again. The source must be a memory dump
+    // (p_offset = p_vaddr) of a file or file descriptor.
+    void setMapSource(bool map) { map_source_ = map; }
+    size_t source_bytes_read() { return source_ != nullptr ? source_->BytesRead() : 0; }
+
 protected:
     bool ReadElfHeader();
     bool VerifyElfHeader();
     bool ReadProgramHeader();
     bool ReserveAddressSpace(uint32_t padding_size = 0);
+    bool MapAddressSpace(Elf_Addr min_vaddr, size_t alloc_size);
     bool LoadSegments();
     bool FindPhdr();
     bool CheckPhdr(uint8_t *);
@@ -51,6 +74,9 @@ protected:
     virtual void GetDynamicSection(Elf_Dyn** dynamic, size_t* dynamic_count, Elf_Word* dynamic_flags);
 
     const char* name_;
+    JobArena* arena_ = nullptr;
+    ImagePool* image_pool_ = nullptr;
+    bool map_source_ = false;
     FileReader* source_ = nullptr;
 
     Elf_Ehdr header_;
@@ -72,6 +98,8 @@ protected:
     // Loaded phdr.
     const Elf_Phdr* loaded_phdr_;
 
+    FixStats* stats_ = nullptr;
+
 
 private:
 
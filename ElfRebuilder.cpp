@@ -6,6 +6,7 @@
 //
 //===----------------------------------------------------------------------===//
 #include <cstdio>
+#include <algorithm>
 #include "ElfRebuilder.h"
 #include "elf.h"
 #include "FDebug.h"
@@ -21,7 +22,23 @@ ElfRebuilder::ElfRebuilder(ObElfReader *elf_reader) {
     elf_reader_ = elf_reader;
 }
 
+ElfRebuilder::~ElfRebuilder() {
+    if (rebuild_data != nullptr) {
+        ImagePool::Release(image_pool_, rebuild_data, rebuild_size);
+        TrackAlloc(stats_, "rebuild_data", -(int64_t)rebuild_size);
+    }
+    TrackAlloc(stats_, "shdrs", -shdrs_tracked_);
+    TrackAlloc(stats_, "shstrtab", -shstrtab_tracked_);
+    TrackAlloc(stats_, "window_relocs", -(int64_t)(window_relocs_.capacity() * sizeof(WindowReloc)));
+}
+
+void ElfRebuilder::setArena(JobArena *arena) {
+    shdrs = ArenaVector<Elf_Shdr>(ArenaAllocator<Elf_Shdr>(arena));
+    shstrtab = ArenaString(ArenaAllocator<char>(arena));
+}
+
 bool ElfRebuilder::RebuildPhdr() {
+    PhaseTimer timer(stats_, "rebuild_phdr");
     FLOGD("=============LoadDynamicSectionFromBaseSource==========RebuildPhdr=========================");
 
 
@@ -39,14 +56,18 @@ bool ElfRebuilder::RebuildPhdr() {
 }
 
 bool ElfRebuilder::RebuildShdr() {
+    PhaseTimer timer(stats_, "rebuild_shdr");
     FLOGD("=======================RebuildShdr=========================");
     // rebuilding shdr, link information
     auto base = si.load_bias;
+    // room for every section below, the arena does not take back grown buffers
+    shdrs.reserve(20);
+    shstrtab.reserve(192);
     shstrtab.push_back('\0');
 
     // empty shdr
     if(true) {
-        Elf_Shdr shdr = {0};
+        Elf_Shdr shdr = {};
         shdrs.push_back(shdr);
     }
 
@@ -54,7 +75,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.symtab != nullptr) {
         sDYNSYM = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".dynsym");
         shstrtab.push_back('\0');
@@ -82,7 +103,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.strtab != nullptr) {
         sDYNSTR = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".dynstr");
         shstrtab.push_back('\0');
@@ -104,7 +125,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.hash != nullptr) {
         sHASH = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".hash");
         shstrtab.push_back('\0');
@@ -127,7 +148,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.rel != nullptr) {
         sRELDYN = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".rel.dyn");
         shstrtab.push_back('\0');
@@ -152,7 +173,7 @@ bool ElfRebuilder::RebuildShdr() {
 
     if (si.plt_rela != nullptr) {
         sRELADYN = shdrs.size();
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".rela.dyn");
         shstrtab.push_back('\0');
@@ -175,7 +196,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.plt_rel != nullptr) {
         sRELPLT = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         if (si.plt_type == DT_REL){
             shstrtab.append(".rel.plt");
@@ -210,7 +231,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.plt_rel != nullptr) {
         sPLT = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".plt");
         shstrtab.push_back('\0');
@@ -233,7 +254,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.plt_rel != nullptr) {
         sTEXTTAB = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".text&ARM.extab");
         shstrtab.push_back('\0');
@@ -260,7 +281,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.ARM_exidx != nullptr) {
         sARMEXIDX = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".ARM.exidx");
         shstrtab.push_back('\0');
@@ -281,7 +302,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.fini_array != nullptr) {
         sFINIARRAY = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".fini_array");
         shstrtab.push_back('\0');
@@ -307,7 +328,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.init_array != nullptr) {
         sINITARRAY = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".init_array");
         shstrtab.push_back('\0');
@@ -333,7 +354,7 @@ bool ElfRebuilder::RebuildShdr() {
     if(si.dynamic != nullptr) {
         sDYNAMIC = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".dynamic");
         shstrtab.push_back('\0');
@@ -394,7 +415,7 @@ bool ElfRebuilder::RebuildShdr() {
         sDATA = shdrs.size();
         auto sLast = sDATA - 1;
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".data");
         shstrtab.push_back('\0');
@@ -412,33 +433,33 @@ bool ElfRebuilder::RebuildShdr() {
         shdrs.push_back(shdr);
     }
 
-    // gen .bss
-//    if(true) {
-//        sBSS = shdrs.size();
-//
-//        Elf_Shdr shdr;
-//        shdr.sh_name = shstrtab.length();
-//        shstrtab.append(".bss");
-//        shstrtab.push_back('\0');
-//
-//        shdr.sh_type = SHT_NOBITS;
-//        shdr.sh_flags = SHF_ALLOC | SHF_WRITE;
-//        shdr.sh_addr = si.max_load;
-//        shdr.sh_offset = shdr.sh_addr;
-//        shdr.sh_size = 0;   // not used
-//        shdr.sh_link = 0;
-//        shdr.sh_info = 0;
-//        shdr.sh_addralign = 8;
-//        shdr.sh_entsize = 0x0;
-//
-//        shdrs.push_back(shdr);
-//    }
+    // gen .bss with the trailing zero data found by RebuildBss
+    if(bss_size != 0) {
+        sBSS = shdrs.size();
+
+        Elf_Shdr shdr = {};
+        shdr.sh_name = shstrtab.length();
+        shstrtab.append(".bss");
+        shstrtab.push_back('\0');
+
+        shdr.sh_type = SHT_NOBITS;
+        shdr.sh_flags = SHF_ALLOC | SHF_WRITE;
+        shdr.sh_addr = bss_start;
+        shdr.sh_offset = shdr.sh_addr;
+        shdr.sh_size = bss_size;
+        shdr.sh_link = 0;
+        shdr.sh_info = 0;
+        shdr.sh_addralign = 8;
+        shdr.sh_entsize = 0x0;
+
+        shdrs.push_back(shdr);
+    }
 
     // gen .shstrtab, pad into last data
     if(true) {
         sSHSTRTAB = shdrs.size();
 
-        Elf_Shdr shdr;
+        Elf_Shdr shdr = {};
         shdr.sh_name = shstrtab.length();
         shstrtab.append(".shstrtab");
         shstrtab.push_back('\0');
@@ -533,19 +554,29 @@ bool ElfRebuilder::RebuildShdr() {
         }
     }
 
+    // both only grow while sections are added
+    shdrs_tracked_ = shdrs.capacity() * sizeof(Elf_Shdr);
+    shstrtab_tracked_ = shstrtab.capacity();
+    TrackAlloc(stats_, "shdrs", shdrs_tracked_);
+    TrackAlloc(stats_, "shstrtab", shstrtab_tracked_);
     FLOGD("=====================RebuildShdr End======================");
     return true;
 }
 
 bool ElfRebuilder::Rebuild() {
+    PhaseTimer timer(stats_, "rebuild");
+    // relocations must be fixed before looking for .bss, a relocated pointer
+    // may be the last non-zero data in the writable segment.
     return RebuildPhdr() &&
            ReadSoInfo() &&
-           RebuildShdr() &&
            RebuildRelocs() &&
+           RebuildBss() &&
+           RebuildShdr() &&
            RebuildFin();
 }
 
 bool ElfRebuilder::ReadSoInfo() {
+    PhaseTimer timer(stats_, "read_so_info");
     FLOGD("=======================ReadSoInfo=========================");
     si.base = si.load_bias = elf_reader_->load_bias();
     si.phdr = elf_reader_->loaded_phdr();
@@ -566,6 +597,7 @@ bool ElfRebuilder::ReadSoInfo() {
 
     // Extract useful information from dynamic section.
     uint32_t needed_count = 0;
+    Elf_Addr plt_rel_size = 0;
     for (Elf_Dyn* d = si.dynamic; d->d_tag != DT_NULL; ++d) {
         switch(d->d_tag){
             case DT_HASH:
@@ -591,6 +623,7 @@ bool ElfRebuilder::ReadSoInfo() {
                 FLOGD("%s plt_rel (DT_JMPREL) found at %" ADDRESS_FORMAT "x", si.name, d->d_un.d_ptr);
                 break;
             case DT_PLTRELSZ:
+                plt_rel_size = d->d_un.d_val;
                 si.plt_rel_count = d->d_un.d_val / sizeof(Elf_Rel);
                 FLOGD("%s plt_rel_count (DT_PLTRELSZ) %zu", si.name, si.plt_rel_count);
                 break;
@@ -700,43 +733,449 @@ bool ElfRebuilder::ReadSoInfo() {
                 break;
         }
     }
+    // DT_PLTREL may come after DT_PLTRELSZ
+    if (si.plt_type == DT_RELA) {
+        si.plt_rel_count = plt_rel_size / sizeof(Elf_Rela);
+    }
     FLOGD("=======================ReadSoInfo End=========================");
     return true;
 }
 
+// Returns the end of the data in [start, end), trailing zero bytes are skipped.
+static const uint8_t* FindDataEnd(const uint8_t* start, const uint8_t* end) {
+    while (end > start && (reinterpret_cast<uintptr_t>(end) & (sizeof(uint64_t) - 1)) != 0) {
+        if (end[-1] != 0) return end;
+        end--;
+    }
+    while (end - start >= (ptrdiff_t)sizeof(uint64_t) &&
+           *reinterpret_cast<const uint64_t*>(end - sizeof(uint64_t)) == 0) {
+        end -= sizeof(uint64_t);
+    }
+    while (end > start && end[-1] == 0) {
+        end--;
+    }
+    return end;
+}
+
+// Returns the end of the non-zero data in a loadable segment.
+Elf_Addr ElfRebuilder::SegmentDataEnd(const Elf_Phdr* load) {
+    Elf_Addr seg_start = load->p_vaddr;
+    Elf_Addr seg_end = seg_start + load->p_memsz;
+    Elf_Addr file_end;
+    if (window_size_ != 0) {
+        // relocations are not applied yet
+        file_end = WindowDataEnd(seg_start, seg_start + load->p_filesz);
+    } else {
+        auto data_end = FindDataEnd(si.load_bias + seg_start, si.load_bias + seg_start + load->p_filesz);
+        file_end = data_end - si.load_bias;
+    }
+    // never cut into other segments(.dynamic, relro...) in this segment, they
+    // are expected to be file backed.
+    for (auto phdr = si.phdr, phdr_limit = si.phdr + si.phnum; phdr < phdr_limit; phdr++) {
+        if (phdr->p_type == PT_LOAD) continue;
+        auto end = phdr->p_vaddr + phdr->p_memsz;
+        if (phdr->p_vaddr >= seg_start && end <= seg_end && end > file_end) {
+            file_end = end;
+        }
+    }
+    return file_end;
+}
+
+// The dumped .bss is stored as zero data at the end of the last writable
+// segment. Shrink p_filesz to the last non-zero byte, so that it is no longer
+// written to file, the loader will clear it.
+bool ElfRebuilder::RebuildBss() {
+    PhaseTimer timer(stats_, "rebuild_bss");
+    FLOGD("=======================RebuildBss=========================");
+    Elf_Phdr* bss_phdr = nullptr;
+    auto phdr = (Elf_Phdr*)elf_reader_->loaded_phdr();
+    for(auto i = 0; i < si.phnum; i++, phdr++) {
+        if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_W) == 0) continue;
+        if (bss_phdr == nullptr || phdr->p_vaddr > bss_phdr->p_vaddr) {
+            bss_phdr = phdr;
+        }
+    }
+    if (bss_phdr == nullptr) {
+        FLOGD("no writable segment found, skip .bss");
+        return true;
+    }
+
+    Elf_Addr seg_end = bss_phdr->p_vaddr + bss_phdr->p_memsz;
+    Elf_Addr file_end = SegmentDataEnd(bss_phdr);
+    file_end = (file_end + sizeof(Elf_Addr) - 1) & ~(Elf_Addr)(sizeof(Elf_Addr) - 1);
+    if (file_end >= seg_end) {
+        FLOGD("no trailing zero data in writable segment");
+        return true;
+    }
+
+    bss_phdr->p_filesz = file_end - bss_phdr->p_vaddr;
+    bss_start = file_end;
+    bss_size = seg_end - file_end;
+    FLOGD(".bss found at %" ADDRESS_FORMAT "x, size %" ADDRESS_FORMAT "x", bss_start, bss_size);
+    FLOGD("=====================RebuildBss End======================");
+    return true;
+}
+
+// Decide where the file backed data of the loaded image is put in file.
+// By default the image is written as is(p_offset = p_vaddr), in compact mode
+// the gaps between segments are dropped, and every segment is put at the
+// first offset congruent to its p_vaddr modulo page size, so that the
+// output can still be mmap-ed. Returns the end of the file data.
+Elf_Addr ElfRebuilder::RebuildLayout(std::vector<FileChunk>& chunks) {
+    auto phdr_limit = si.phdr + si.phnum;
+    Elf_Addr file_end = si.max_load - si.min_load;
+    // .bss is not file backed, data stop at the end of the file backed phdr
+    if (!isCompactLayout) {
+        if (bss_size != 0) {
+            file_end = 0;
+            for (auto phdr = si.phdr; phdr < phdr_limit; phdr++) {
+                if (phdr->p_offset + phdr->p_filesz > file_end) {
+                    file_end = phdr->p_offset + phdr->p_filesz;
+                }
+            }
+        }
+        FileChunk chunk = {0, file_end, 0};
+        chunks.push_back(chunk);
+        return file_end;
+    }
+
+    // memory released by shell is dumped as zero pages, segments may have
+    // been expanded to them by FixDumpSoPhdr. Trailing zero pages are dropped,
+    // the loader will clear them.
+    auto load = (Elf_Phdr*)elf_reader_->loaded_phdr();
+    for(auto i = 0; i < si.phnum; i++, load++) {
+        if (load->p_type != PT_LOAD) continue;
+        Elf_Addr filesz = PAGE_END(SegmentDataEnd(load)) - load->p_vaddr;
+        if (filesz < load->p_filesz) {
+            load->p_filesz = filesz;
+        }
+    }
+    // sections must not run past the file data of their segment, what is cut
+    // off is zero and cleared by the loader
+    for(size_t i = 1; i < shdrs.size(); i++) {
+        auto& shdr = shdrs[i];
+        if (i == sSHSTRTAB || shdr.sh_type == SHT_NOBITS || shdr.sh_addr == 0) continue;
+        for (auto phdr = si.phdr, phdr_limit = si.phdr + si.phnum; phdr < phdr_limit; phdr++) {
+            if (phdr->p_type != PT_LOAD || shdr.sh_addr < phdr->p_vaddr ||
+                shdr.sh_addr >= phdr->p_vaddr + phdr->p_memsz) continue;
+            Elf_Addr data_end = phdr->p_vaddr + phdr->p_filesz;
+            if (shdr.sh_addr >= data_end) {
+                shdr.sh_type = SHT_NOBITS;
+            } else if (shdr.sh_addr + shdr.sh_size > data_end) {
+                shdr.sh_size = data_end - shdr.sh_addr;
+            }
+            break;
+        }
+    }
+
+    // elf header and phdr table must stay at the beginning of file
+    auto ehdr = elf_reader_->record_ehdr();
+    std::vector<FileChunk> ranges;
+    FileChunk header = {0, (Elf_Addr)(ehdr->e_phoff + si.phnum * sizeof(Elf_Phdr)), 0};
+    ranges.push_back(header);
+    for (auto phdr = si.phdr; phdr < phdr_limit; phdr++) {
+        if (phdr->p_filesz == 0) continue;
+        if (phdr->p_type != PT_LOAD) {
+            // data loaded from base so is appended after the loadable segments
+            bool in_load = false;
+            for (auto load = si.phdr; load < phdr_limit; load++) {
+                if (load->p_type == PT_LOAD && phdr->p_vaddr >= load->p_vaddr &&
+                    phdr->p_vaddr + phdr->p_filesz <= load->p_vaddr + load->p_filesz) {
+                    in_load = true;
+                    break;
+                }
+            }
+            if (in_load) continue;
+        }
+        FileChunk range = {phdr->p_vaddr, phdr->p_filesz, 0};
+        ranges.push_back(range);
+    }
+    std::sort(ranges.begin(), ranges.end(),
+              [](const FileChunk& first, const FileChunk& second) {
+                  return first.vaddr < second.vaddr;
+              });
+
+    file_end = 0;
+    for (auto& range : ranges) {
+        if (!chunks.empty()) {
+            auto& last = chunks.back();
+            auto last_end = last.vaddr + last.size;
+            // ranges sharing a page are kept together
+            if (range.vaddr < last_end + PAGE_SIZE) {
+                if (range.vaddr + range.size > last_end) {
+                    last.size = range.vaddr + range.size - last.vaddr;
+                    file_end = last.offset + last.size;
+                }
+                continue;
+            }
+        }
+        FileChunk chunk = range;
+        chunk.offset = file_end + PAGE_OFFSET(range.vaddr - file_end);
+        file_end = chunk.offset + chunk.size;
+        chunks.push_back(chunk);
+        FLOGD("segment %" ADDRESS_FORMAT "x is put at file offset %" ADDRESS_FORMAT "x",
+              chunk.vaddr, chunk.offset);
+    }
+
+    // fix file offset with new layout
+    auto phdr = (Elf_Phdr*)elf_reader_->loaded_phdr();
+    for(auto i = 0; i < si.phnum; i++, phdr++) {
+        phdr->p_offset = ChunkOffset(chunks, phdr->p_vaddr);
+        // segments are only kept congruent in page size
+        if (phdr->p_type == PT_LOAD && phdr->p_align > PAGE_SIZE &&
+            (phdr->p_vaddr - phdr->p_offset) % phdr->p_align != 0) {
+            phdr->p_align = PAGE_SIZE;
+        }
+    }
+    for(auto i = 1; i < shdrs.size(); i++) {
+        shdrs[i].sh_offset = ChunkOffset(chunks, shdrs[i].sh_addr);
+    }
+    return file_end;
+}
+
+// Returns the file offset of vaddr. Address out of file backed data is
+// mapped to the end of the chunk before it.
+Elf_Addr ElfRebuilder::ChunkOffset(const std::vector<FileChunk>& chunks, Elf_Addr vaddr) {
+    Elf_Addr offset = 0;
+    for (auto& chunk : chunks) {
+        if (chunk.vaddr > vaddr) break;
+        offset = chunk.offset + std::min(vaddr - chunk.vaddr, chunk.size);
+    }
+    return offset;
+}
+
 // Finally, generate rebuild_data
 bool ElfRebuilder::RebuildFin() {
+    PhaseTimer timer(stats_, "rebuild_fin");
     FLOGD("=======================try to finish file rebuild =========================");
-    auto load_size = si.max_load - si.min_load;
+    std::vector<FileChunk> chunks;
+    auto load_size = RebuildLayout(chunks);
+    shdrs[sSHSTRTAB].sh_offset = load_size;
+
     rebuild_size = load_size + shstrtab.length() +
                    shdrs.size() * sizeof(Elf_Shdr);
-    rebuild_data = new uint8_t[rebuild_size];
-    memcpy(rebuild_data, (void*)si.load_bias, load_size);
+    rebuild_data = ImagePool::Acquire(image_pool_, rebuild_size);
+    TrackAlloc(stats_, "rebuild_data", rebuild_size);
+    if (chunks.size() > 1) {
+        memset(rebuild_data, 0, load_size);
+    }
+    for (auto& chunk : chunks) {
+        memcpy(rebuild_data + chunk.offset, (void*)(si.load_bias + chunk.vaddr), chunk.size);
+    }
     // pad with shstrtab
     memcpy(rebuild_data + load_size, shstrtab.c_str(), shstrtab.length());
     // pad with shdrs
     auto shdr_off = load_size + shstrtab.length();
     memcpy(rebuild_data + (int)shdr_off, (void*)&shdrs[0],
            shdrs.size() * sizeof(Elf_Shdr));
-    auto ehdr = *elf_reader_->record_ehdr();
-    ehdr.e_type = ET_DYN;
+    Elf_Ehdr ehdr;
+    BuildEhdr(&ehdr, shdr_off);
+    memcpy(rebuild_data, &ehdr, sizeof(Elf_Ehdr));
+
+    file_chunks = chunks;
+    FLOGD("=======================End=========================");
+    return true;
+}
+
+void ElfRebuilder::BuildEhdr(Elf_Ehdr* ehdr, Elf_Addr shdr_off) {
+    *ehdr = *elf_reader_->record_ehdr();
+    ehdr->e_type = ET_DYN;
 #ifdef __SO64__
-    ehdr.e_machine = 183;
+    ehdr->e_machine = 183;
 #else
-    ehdr.e_machine = 40;
+    ehdr->e_machine = 40;
 #endif
-    ehdr.e_shnum = shdrs.size();
-    ehdr.e_shoff = (Elf_Addr)shdr_off;
-    ehdr.e_shstrndx = sSHSTRTAB;
-    memcpy(rebuild_data, &ehdr, sizeof(Elf_Ehdr));
+    ehdr->e_shnum = shdrs.size();
+    if (stats_ != nullptr) {
+        stats_->sections = shdrs.size();
+    }
+    ehdr->e_shoff = shdr_off;
+    ehdr->e_shstrndx = sSHSTRTAB;
+}
+
+bool ElfRebuilder::RebuildWindowed(size_t window_size, const std::function<bool(const void*, size_t)>& write) {
+    PhaseTimer timer(stats_, "rebuild");
+    if (isCompactLayout) {
+        FLOGE("compact layout can not be rebuilt in windows");
+        return false;
+    }
+    window_size_ = PAGE_END(std::max<size_t>(window_size, PAGE_SIZE));
+    if (!RebuildPhdr() || !ReadSoInfo()) {
+        return false;
+    }
+    if (si.min_load != 0) {
+        FLOGE("image loaded at %" ADDRESS_FORMAT "x can not be rebuilt in windows", si.min_load);
+        return false;
+    }
+    if (!CollectWindowRelocs() || !RebuildBss() || !RebuildShdr()) {
+        return false;
+    }
+
+    PhaseTimer fin_timer(stats_, "rebuild_fin");
+    FLOGD("=======================write file in windows =========================");
+    std::vector<FileChunk> chunks;
+    auto load_size = RebuildLayout(chunks);
+    shdrs[sSHSTRTAB].sh_offset = load_size;
+    rebuild_size = load_size + shstrtab.length() +
+                   shdrs.size() * sizeof(Elf_Shdr);
+    Elf_Ehdr ehdr;
+    BuildEhdr(&ehdr, load_size + shstrtab.length());
+    memcpy(si.load_bias, &ehdr, sizeof(Elf_Ehdr));
+
+    TrackAlloc(stats_, "window", window_size_);
+    Elf_Addr end;
+    for (Elf_Addr start = 0; start < load_size; start = end) {
+        end = std::min<Elf_Addr>(start + window_size_, load_size);
+        // a relocated pointer is never split, it goes to the window it starts in
+        auto it = std::lower_bound(window_relocs_.begin(), window_relocs_.end(),
+                                   end > sizeof(Elf_Addr) ? end - sizeof(Elf_Addr) + 1 : 0,
+                                   [](const WindowReloc& reloc, Elf_Addr offset) {
+                                       return reloc.rela.r_offset < offset;
+                                   });
+        for (; it != window_relocs_.end() && it->rela.r_offset < end; it++) {
+            end = std::max<Elf_Addr>(end, it->rela.r_offset + sizeof(Elf_Addr));
+        }
+        end = std::min<Elf_Addr>(end, load_size);
 
+        ApplyWindowRelocs(start, end, si.load_bias, 0, elf_reader_->load_size());
+        if (!write(si.load_bias + start, end - start)) {
+            TrackAlloc(stats_, "window", -(int64_t)window_size_);
+            return false;
+        }
+        DropWindow(PAGE_START(start), end == load_size ? PAGE_END(end) : end);
+    }
+    TrackAlloc(stats_, "window", -(int64_t)window_size_);
+    if (!write(shstrtab.c_str(), shstrtab.length()) ||
+        !write(&shdrs[0], shdrs.size() * sizeof(Elf_Shdr))) {
+        return false;
+    }
+    file_chunks = chunks;
     FLOGD("=======================End=========================");
     return true;
 }
 
+// Classify the relocations as RebuildRelocs does, and keep the ones changing
+// the image to be applied with their window. Unresolved symbols are given
+// their external pointer here, in the order of RebuildRelocs.
+bool ElfRebuilder::CollectWindowRelocs() {
+    if(elf_reader_->dump_so_base_ == 0) return true;
+    PhaseTimer timer(stats_, "rebuild_relocs");
+    auto dump_base = elf_reader_->dump_so_base_;
+    bool isRela = si.plt_type != DT_REL;
+    auto collect = [&](uint8_t* table, size_t count, size_t entsize, RelocHistogram& histogram) {
+        if (table == nullptr || count == 0) {
+            return;
+        }
+        for (size_t i = 0; i < count; i++, table += entsize) {
+            WindowReloc reloc = {};
+            memcpy(&reloc.rela, table, entsize);
+            reloc.external = external_pointer;
+            reloc.index = window_relocs_.size();
+            // the value is only needed to know what the relocation does
+            Elf_Addr value = 0;
+            auto outcome = isRela ? relocate<true>(&value, (Elf_Rel*)&reloc.rela, dump_base, histogram) :
+                           relocate<false>(&value, (Elf_Rel*)&reloc.rela, dump_base, histogram);
+            if (outcome != RELOC_SKIPPED) {
+                window_relocs_.push_back(reloc);
+            }
+        }
+        // read again only if the table is in a window written later
+        DropWindow(table - count * entsize - si.load_bias, table - si.load_bias);
+    };
+    window_relocs_.reserve((isRela ? si.plt_rela_count : si.rel_count) + si.plt_rel_count);
+    if (!isRela) {
+        collect((uint8_t*)si.rel, si.rel_count, sizeof(Elf_Rel), relocs_[RELOC_TABLE_REL]);
+        collect((uint8_t*)si.plt_rel, si.plt_rel_count, sizeof(Elf_Rel), relocs_[RELOC_TABLE_PLT_REL]);
+    } else {
+        collect((uint8_t*)si.plt_rela, si.plt_rela_count, sizeof(Elf_Rela), relocs_[RELOC_TABLE_PLT_RELA]);
+        collect((uint8_t*)si.plt_rel, si.plt_rel_count, sizeof(Elf_Rela), relocs_[RELOC_TABLE_PLT_REL]);
+    }
+    std::sort(window_relocs_.begin(), window_relocs_.end(),
+              [](const WindowReloc& first, const WindowReloc& second) {
+                  return first.rela.r_offset < second.rela.r_offset ||
+                         (first.rela.r_offset == second.rela.r_offset && first.index < second.index);
+              });
+    TrackAlloc(stats_, "window_relocs", window_relocs_.capacity() * sizeof(WindowReloc));
+    FLOGD("%zu relocations are applied in windows", window_relocs_.size());
+    ReportRelocs();
+    if (stats_ != nullptr) {
+        std::copy(relocs_, relocs_ + RELOC_TABLE_COUNT, stats_->relocations);
+    }
+    return true;
+}
+
+void ElfRebuilder::ApplyWindowRelocs(Elf_Addr start, Elf_Addr end, uint8_t* data,
+                                     Elf_Addr data_start, Elf_Addr data_end) {
+    auto dump_base = elf_reader_->dump_so_base_;
+    bool isRela = si.plt_type != DT_REL;
+    // counted by CollectWindowRelocs
+    RelocHistogram histogram;
+    auto it = std::lower_bound(window_relocs_.begin(), window_relocs_.end(), start,
+                               [](const WindowReloc& reloc, Elf_Addr offset) {
+                                   return reloc.rela.r_offset < offset;
+                               });
+    for (; it != window_relocs_.end() && it->rela.r_offset < end; it++) {
+        if (it->rela.r_offset < data_start || it->rela.r_offset + sizeof(Elf_Addr) > data_end) {
+            continue;
+        }
+        auto prel = reinterpret_cast<Elf_Addr*>(data + (it->rela.r_offset - data_start));
+        external_pointer = it->external;
+        if (isRela) {
+            relocate<true>(prel, (Elf_Rel*)&it->rela, dump_base, histogram);
+        } else {
+            relocate<false>(prel, (Elf_Rel*)&it->rela, dump_base, histogram);
+        }
+    }
+}
+
+// FindDataEnd of image [start, end) as if it is relocated. Windows are
+// relocated in a copy from the end, until non-zero data is found.
+Elf_Addr ElfRebuilder::WindowDataEnd(Elf_Addr start, Elf_Addr end) {
+    std::vector<uint8_t> data;
+    while (end > start) {
+        auto window_start = end - std::min<Elf_Addr>(window_size_, end - start);
+        // with pointers relocated across both ends of the window, aligned
+        // as in image
+        auto data_start = (window_start - std::min<Elf_Addr>(window_start, sizeof(Elf_Addr) - 1)) &
+                          ~(Elf_Addr)(sizeof(Elf_Addr) - 1);
+        auto data_end = std::min<Elf_Addr>(end + sizeof(Elf_Addr), elf_reader_->load_size());
+        data.assign(si.load_bias + data_start, si.load_bias + data_end);
+        ApplyWindowRelocs(data_start, end, data.data(), data_start, data_end);
+        auto window = data.data() + (window_start - data_start);
+        auto found = FindDataEnd(window, data.data() + (end - data_start));
+        DropWindow(window_start, end);
+        if (found != window) {
+            return window_start + (found - window);
+        }
+        end = window_start;
+    }
+    return start;
+}
+
+// Give back pages of image in [start, end) which are written or scanned, the
+// dump is read again if they are touched. The phdr table changed by rebuild
+// is kept.
+void ElfRebuilder::DropWindow(Elf_Addr start, Elf_Addr end) {
+#ifdef SOFIXER_HAVE_FD_READER
+    end = std::min<Elf_Addr>(end, elf_reader_->load_size());
+    Elf_Addr page_start = PAGE_END(start);
+    Elf_Addr page_end = PAGE_START(end);
+    Elf_Addr phdr = (uint8_t*)elf_reader_->loaded_phdr() - si.load_bias;
+    Elf_Addr phdr_start = PAGE_START(phdr);
+    Elf_Addr phdr_end = PAGE_END(phdr + si.phnum * sizeof(Elf_Phdr));
+    if (page_start < std::min(page_end, phdr_start)) {
+        madvise(si.load_bias + page_start, std::min(page_end, phdr_start) - page_start, MADV_DONTNEED);
+    }
+    if (std::max(page_start, phdr_end) < page_end) {
+        madvise(si.load_bias + std::max(page_start, phdr_end), page_end - std::max(page_start, phdr_end),
+                MADV_DONTNEED);
+    }
+#endif
+}
+
 template <bool isRela>
-void ElfRebuilder::relocate(uint8_t * base, Elf_Rel* rel, Elf_Addr dump_base) {
-    if(rel == nullptr) return ;
+RelocOutcome ElfRebuilder::relocate(Elf_Addr * prel, Elf_Rel* rel, Elf_Addr dump_base, RelocHistogram& histogram) {
+    if(rel == nullptr) return RELOC_SKIPPED;
 #ifndef __SO64__
     auto type = ELF32_R_TYPE(rel->r_info);
     auto sym = ELF32_R_SYM(rel->r_info);
@@ -744,21 +1183,24 @@ void ElfRebuilder::relocate(uint8_t * base, Elf_Rel* rel, Elf_Addr dump_base) {
     auto type = ELF64_R_TYPE(rel->r_info);
     auto sym = ELF64_R_SYM(rel->r_info);
 #endif
-    auto prel = reinterpret_cast<Elf_Addr *>(base + rel->r_offset);
+    auto outcome = RELOC_SKIPPED;
     switch (type) {
         // I don't known other so info, if i want to fix it, I must dump other so file
         case R_386_RELATIVE:
         case R_ARM_RELATIVE:
             *prel = *prel - dump_base;
+            outcome = RELOC_APPLIED;
             break;
         case 0x402:{
             auto syminfo = si.symtab[sym];
             if (syminfo.st_value != 0) {
                 *prel = syminfo.st_value;
+                outcome = RELOC_APPLIED;
             } else {
                 auto load_size = si.max_load - si.min_load;
                 *prel = load_size + external_pointer;
                 external_pointer += sizeof(*prel);
+                outcome = RELOC_UNRESOLVED;
             }
             break;
         }
@@ -770,36 +1212,76 @@ void ElfRebuilder::relocate(uint8_t * base, Elf_Rel* rel, Elf_Addr dump_base) {
         switch (type){
             case 0x403:
                 *prel = rela->r_addend;
+                outcome = RELOC_APPLIED;
                 break;
             default:
                 break;
         }
     }
+    histogram.Add(type, outcome);
+    return outcome;
 };
 
+void ElfRebuilder::ReportRelocs() {
+    for (int t = 0; t < RELOC_TABLE_COUNT; t++) {
+        auto total = relocs_[t].Total();
+        if (total.processed() == 0) {
+            continue;
+        }
+        FLOGD("%s: %llu relocations, %llu applied, %llu skipped, %llu unresolved", RelocTableName(t),
+              (unsigned long long)total.processed(), (unsigned long long)total.outcomes[RELOC_APPLIED],
+              (unsigned long long)total.outcomes[RELOC_SKIPPED], (unsigned long long)total.outcomes[RELOC_UNRESOLVED]);
+        if (total.outcomes[RELOC_SKIPPED] == 0) {
+            continue;
+        }
+        std::string types;
+        for (auto& type : relocs_[t].Types()) {
+            auto skipped = type.second.outcomes[RELOC_SKIPPED];
+            if (skipped != 0) {
+                char buf[64];
+                snprintf(buf, sizeof(buf), "%s0x%x(%llu)", types.empty() ? "" : ", ", type.first,
+                         (unsigned long long)skipped);
+                types += buf;
+            }
+        }
+        FLOGI("%s: %llu of %llu relocations are not fixed, types %s", RelocTableName(t),
+              (unsigned long long)total.outcomes[RELOC_SKIPPED], (unsigned long long)total.processed(),
+              types.c_str());
+    }
+}
+
 
 bool ElfRebuilder::RebuildRelocs() {
     if(elf_reader_->dump_so_base_ == 0) return true;
+    PhaseTimer timer(stats_, "rebuild_relocs");
     FLOGD("=======================RebuildRelocs=========================");
     if (si.plt_type == DT_REL) {
         auto rel = si.rel;
         for (auto i = 0; i < si.rel_count; i++, rel++){
-            relocate<false>(si.load_bias, rel, elf_reader_->dump_so_base_);
+            relocate<false>(reinterpret_cast<Elf_Addr *>(si.load_bias + rel->r_offset), rel, elf_reader_->dump_so_base_,
+                            relocs_[RELOC_TABLE_REL]);
         }
         rel = si.plt_rel;
         for (auto i = 0; i < si.plt_rel_count; i++, rel++){
-            relocate<false>(si.load_bias, rel, elf_reader_->dump_so_base_);
+            relocate<false>(reinterpret_cast<Elf_Addr *>(si.load_bias + rel->r_offset), rel, elf_reader_->dump_so_base_,
+                            relocs_[RELOC_TABLE_PLT_REL]);
         }
     } else {
         auto rel = (Elf_Rela*)si.plt_rela;
         for (auto i = 0; i <si.plt_rela_count; i++, rel ++) {
-            relocate<true>(si.load_bias, (Elf_Rel*)rel, elf_reader_->dump_so_base_);
+            relocate<true>(reinterpret_cast<Elf_Addr *>(si.load_bias + rel->r_offset), (Elf_Rel*)rel, elf_reader_->dump_so_base_,
+                           relocs_[RELOC_TABLE_PLT_RELA]);
         }
         rel = (Elf_Rela*) si.plt_rel;
         for (auto i = 0; i < si.plt_rel_count; i++, rel++){
-            relocate<true>(si.load_bias, (Elf_Rel*)rel, elf_reader_->dump_so_base_);
+            relocate<true>(reinterpret_cast<Elf_Addr *>(si.load_bias + rel->r_offset), (Elf_Rel*)rel, elf_reader_->dump_so_base_,
+                           relocs_[RELOC_TABLE_PLT_REL]);
         }
     }
+    ReportRelocs();
+    if (stats_ != nullptr) {
+        std::copy(relocs_, relocs_ + RELOC_TABLE_COUNT, stats_->relocations);
+    }
     auto relocate_address = [](Elf_Addr * pelf, Elf_Addr dump_base){
         if (*pelf > dump_base)
             *pelf = *pelf - dump_base;
@@ -810,6 +1292,146 @@ bool ElfRebuilder::RebuildRelocs() {
     return true;
 }
 
+void ElfRebuilder::CollectRefixMeta(RefixMeta *meta) {
+    auto base = si.load_bias;
+    meta->source_size = elf_reader_->source_size();
+    meta->dump_base = elf_reader_->dump_so_base_;
+    meta->load_size = si.max_load - si.min_load;
+    meta->symtab = si.symtab != nullptr ? (uint8_t*)si.symtab - base : 0;
+    for (auto& chunk : file_chunks) {
+        RefixMeta::Chunk c = {chunk.vaddr, chunk.size, chunk.offset};
+        meta->chunks.push_back(c);
+    }
+
+    auto add_fixed = [&](Elf_Addr vaddr, Elf_Addr size) {
+        if (size == 0 || vaddr >= meta->source_size) return;
+        RefixMeta::Range range = {vaddr, size};
+        meta->fixed.push_back(range);
+    };
+    auto ehdr = elf_reader_->record_ehdr();
+    add_fixed(0, ehdr->e_phoff + si.phnum * sizeof(Elf_Phdr));
+    add_fixed((uint8_t*)si.phdr - base, si.phnum * sizeof(Elf_Phdr));
+    for (auto i = 1; i < shdrs.size(); i++) {
+        auto& shdr = shdrs[i];
+        if (shdr.sh_type == SHT_DYNSYM || shdr.sh_type == SHT_HASH || shdr.sh_type == SHT_DYNAMIC ||
+            (shdr.sh_type == SHT_STRTAB && (shdr.sh_flags & SHF_ALLOC) != 0)) {
+            add_fixed(shdr.sh_addr, shdr.sh_size);
+        }
+    }
+
+    // same tables in the same order as RebuildRelocs
+    auto add_table = [&](bool rela, const void* table, size_t count) {
+        if (table == nullptr || count == 0) return;
+        RefixMeta::RelTable t = {rela, (Elf_Addr)((uint8_t*)table - base), (Elf_Addr)count};
+        meta->tables.push_back(t);
+        add_fixed(t.vaddr, count * (rela ? sizeof(Elf_Rela) : sizeof(Elf_Rel)));
+    };
+    if (meta->dump_base != 0) {
+        if (si.plt_type == DT_REL) {
+            add_table(false, si.rel, si.rel_count);
+            add_table(false, si.plt_rel, si.plt_rel_count);
+        } else {
+            add_table(true, si.plt_rela, si.plt_rela_count);
+            add_table(true, si.plt_rel, si.plt_rel_count);
+        }
+    }
+
+    // the end of segment data decides .bss and the compact layout
+    const Elf_Phdr* bss_phdr = nullptr;
+    for (auto phdr = si.phdr, phdr_limit = si.phdr + si.phnum; phdr < phdr_limit; phdr++) {
+        if (phdr->p_type == PT_DYNAMIC || phdr->p_type == PT_PHDR) {
+            add_fixed(phdr->p_vaddr, phdr->p_memsz);
+        }
+        if (phdr->p_type != PT_LOAD) continue;
+        Elf_Addr load_end = std::min<Elf_Addr>(phdr->p_vaddr + phdr->p_memsz, meta->source_size);
+        if (load_end > phdr->p_vaddr) {
+            RefixMeta::Range range = {phdr->p_vaddr, load_end - phdr->p_vaddr};
+            meta->loads.push_back(range);
+        }
+        if ((phdr->p_flags & PF_W) != 0 && (bss_phdr == nullptr || phdr->p_vaddr > bss_phdr->p_vaddr)) {
+            bss_phdr = phdr;
+        }
+    }
+    for (auto phdr = si.phdr, phdr_limit = si.phdr + si.phnum; phdr < phdr_limit; phdr++) {
+        if (phdr->p_type != PT_LOAD || (!isCompactLayout && phdr != bss_phdr)) continue;
+        auto data_end = SegmentDataEnd(phdr);
+        auto start = data_end > phdr->p_vaddr ? PAGE_START(data_end - 1) : phdr->p_vaddr;
+        add_fixed(start, phdr->p_vaddr + phdr->p_memsz - start);
+    }
+}
 
+bool ElfRebuilder::RebuildPatch(const RefixMeta &meta, const uint8_t *dump,
+                                const std::vector<bool> &changed, uint8_t *output, size_t output_size) {
+    FLOGD("=======================RebuildPatch=========================");
+    // refix data is read from disk, writes stay inside output
+    for (auto& chunk : meta.chunks) {
+        if (chunk.offset > output_size || chunk.size > output_size - chunk.offset) {
+            FLOGE("previous output does not match its refix data");
+            return false;
+        }
+    }
+    auto page_changed = [&](Elf_Addr vaddr) {
+        auto page = vaddr / PAGE_SIZE;
+        return page < changed.size() && changed[page];
+    };
+    // Returns the output address of image data [vaddr, vaddr + size).
+    auto output_addr = [&](Elf_Addr vaddr, Elf_Addr size) -> uint8_t* {
+        for (auto& chunk : meta.chunks) {
+            if (vaddr >= chunk.vaddr && vaddr + size <= chunk.vaddr + chunk.size) {
+                return output + chunk.offset + (vaddr - chunk.vaddr);
+            }
+        }
+        return nullptr;
+    };
 
+    for (size_t page = 0; page < changed.size(); page++) {
+        if (!changed[page]) continue;
+        Elf_Addr start = page * PAGE_SIZE;
+        Elf_Addr end = std::min<Elf_Addr>(start + PAGE_SIZE, meta.source_size);
+        for (auto& load : meta.loads) {
+            for (auto& chunk : meta.chunks) {
+                auto s = std::max(std::max(start, load.vaddr), chunk.vaddr);
+                auto e = std::min(std::min(end, load.vaddr + load.size), chunk.vaddr + chunk.size);
+                if (s < e) {
+                    memcpy(output + chunk.offset + (s - chunk.vaddr), dump + s, e - s);
+                }
+            }
+        }
+    }
 
+    if (meta.dump_base != 0) {
+        // every relocation is replayed to keep external symbols in order, only
+        // the ones in changed pages are written
+        si.symtab = meta.symtab != 0 ? (Elf_Sym*)(dump + meta.symtab) : nullptr;
+        si.min_load = 0;
+        si.max_load = meta.load_size;
+        external_pointer = 0;
+        // tables are unchanged, so are the outcomes counted by the full rebuild
+        RelocHistogram scratch_histogram;
+        for (auto& table : meta.tables) {
+            auto entry_size = table.rela ? sizeof(Elf_Rela) : sizeof(Elf_Rel);
+            if (table.vaddr + table.count * entry_size > meta.source_size) {
+                FLOGE("relocation table %" ADDRESS_FORMAT "x is out of dump", table.vaddr);
+                return false;
+            }
+            for (Elf_Addr i = 0; i < table.count; i++) {
+                auto rel = (Elf_Rel*)(dump + table.vaddr + i * entry_size);
+                Elf_Addr scratch = 0;
+                auto prel = &scratch;
+                if (page_changed(rel->r_offset) || page_changed(rel->r_offset + sizeof(Elf_Addr) - 1)) {
+                    auto addr = output_addr(rel->r_offset, sizeof(Elf_Addr));
+                    if (addr != nullptr) {
+                        prel = reinterpret_cast<Elf_Addr*>(addr);
+                    }
+                }
+                if (table.rela) {
+                    relocate<true>(prel, rel, meta.dump_base, scratch_histogram);
+                } else {
+                    relocate<false>(prel, rel, meta.dump_base, scratch_histogram);
+                }
+            }
+        }
+    }
+    FLOGD("=====================RebuildPatch End======================");
+    return true;
+}
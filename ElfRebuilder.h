@@ -10,9 +10,11 @@
 #define SOFIXER_ELFREBUILDER_H
 
 #include <cstdint>
+#include <functional>
 #include <vector>
 #include <string>
 #include "ObElfReader.h"
+#include "Refix.h"
 
 
 
@@ -91,20 +93,74 @@ public:
 class ElfRebuilder {
 public:
     ElfRebuilder(ObElfReader* elf_reader);
-    ~ElfRebuilder() { if(rebuild_data != nullptr) delete []rebuild_data; }
+    ~ElfRebuilder();
     bool Rebuild();
+    // Rebuild a mapped image(ElfReader::setMapSource) window by window, the
+    // output is passed to write in order and the written pages of image are
+    // dropped, so at most a window of the image is resident. Relocations are
+    // applied when their window is written, the output is the same as the
+    // one of Rebuild without compact layout.
+    bool RebuildWindowed(size_t window_size, const std::function<bool(const void*, size_t)>& write);
+    // memory held by RebuildWindowed for relocations delayed to their window
+    static size_t WindowRelocMemory(size_t relocations) { return relocations * sizeof(WindowReloc); }
 
     void* getRebuildData() { return rebuild_data; }
     size_t getRebuildSize() { return rebuild_size; }
+    // rebuild data is owned by caller, and goes back to image pool when released
+    ImageBuffer releaseRebuildData() {
+        ImageBuffer data(rebuild_data, ImageDeleter(image_pool_, rebuild_size));
+        rebuild_data = nullptr;
+        // held by caller from now on
+        TrackAlloc(stats_, "rebuild_data", -(int64_t)rebuild_size);
+        return data;
+    }
+
+    // Describe how the output is built from dump, call after Rebuild.
+    void CollectRefixMeta(RefixMeta* meta);
+    // Copy the changed pages of dump into output built from an earlier dump
+    // of the same library and relocate them, no elf reader is needed.
+    bool RebuildPatch(const RefixMeta& meta, const uint8_t* dump,
+                      const std::vector<bool>& changed, uint8_t* output, size_t output_size);
 private:
     bool RebuildPhdr();
     bool RebuildShdr();
     bool ReadSoInfo();
     bool RebuildRelocs();
+    bool RebuildBss();
+    Elf_Addr SegmentDataEnd(const Elf_Phdr* load);
     bool RebuildFin();
+    void BuildEhdr(Elf_Ehdr* ehdr, Elf_Addr shdr_off);
+
+    // a file backed range of the loaded image, and where it is put in file
+    struct FileChunk {
+        Elf_Addr vaddr;
+        Elf_Addr size;
+        Elf_Addr offset;
+    };
+    Elf_Addr RebuildLayout(std::vector<FileChunk>& chunks);
+    static Elf_Addr ChunkOffset(const std::vector<FileChunk>& chunks, Elf_Addr vaddr);
 
   template <bool isRela>
-  void relocate(uint8_t * base, Elf_Rel* rel, Elf_Addr dump_base);
+  RelocOutcome relocate(Elf_Addr * prel, Elf_Rel* rel, Elf_Addr dump_base, RelocHistogram& histogram);
+    // log the relocations RebuildRelocs could not fix
+    void ReportRelocs();
+
+    // a relocation delayed to the window of its target
+    struct WindowReloc {
+        // copy of the entry, r_addend is only set with DT_RELA
+        Elf_Rela rela;
+        // external_pointer when it is applied in RebuildRelocs order
+        unsigned external;
+        // position in RebuildRelocs order, relocations of the same target
+        // are applied in it
+        uint32_t index;
+    };
+    bool CollectWindowRelocs();
+    // apply delayed relocations overlapping [start, end) to data holding
+    // image [data_start, data_end)
+    void ApplyWindowRelocs(Elf_Addr start, Elf_Addr end, uint8_t* data, Elf_Addr data_start, Elf_Addr data_end);
+    Elf_Addr WindowDataEnd(Elf_Addr start, Elf_Addr end);
+    void DropWindow(Elf_Addr start, Elf_Addr end);
     ObElfReader* elf_reader_;
     soinfo si;
 
@@ -128,14 +184,42 @@ private:
     Elf_Word sBSS = 0;
     Elf_Word sSHSTRTAB = 0;
 
-    std::vector<Elf_Shdr> shdrs;
-    std::string shstrtab;
+    ArenaVector<Elf_Shdr> shdrs;
+    ArenaString shstrtab;
+    // layout of the output made by RebuildFin
+    std::vector<FileChunk> file_chunks;
+
+    // trailing zero data of the last writable segment, emitted as .bss
+    Elf_Addr bss_start = 0;
+    Elf_Addr bss_size = 0;
 
   unsigned external_pointer = 0;
 private:
     bool isPatchInit = false;
+    bool isCompactLayout = false;
 public:
     void setPatchInit(bool b) { isPatchInit = b; }
+    // pack segments in file instead of keeping p_offset = p_vaddr
+    void setCompactLayout(bool b) { isCompactLayout = b; }
+    // time of rebuild steps and relocations are recorded if set
+    void setStats(FixStats* stats) { stats_ = stats; }
+    // shdrs and shstrtab are allocated from arena if set, it must be set
+    // before Rebuild
+    void setArena(JobArena* arena);
+    // rebuild data is taken from pool if set
+    void setImagePool(ImagePool* pool) { image_pool_ = pool; }
+    // relocations of the table fixed by RebuildRelocs, by type and outcome
+    const RelocHistogram& getRelocHistogram(RelocTable table) const { return relocs_[table]; }
+private:
+    FixStats* stats_ = nullptr;
+    RelocHistogram relocs_[RELOC_TABLE_COUNT];
+    ImagePool* image_pool_ = nullptr;
+    // windowed rebuild, relocations sorted by target
+    size_t window_size_ = 0;
+    std::vector<WindowReloc> window_relocs_;
+    // bytes of shdrs and shstrtab recorded to stats
+    int64_t shdrs_tracked_ = 0;
+    int64_t shstrtab_tracked_ = 0;
 };
 
 
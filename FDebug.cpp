@@ -0,0 +1,187 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "FDebug.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// power of 2
+#define LOG_RING_SIZE 1024
+#define LOG_SLOT_SIZE 512
+
+std::atomic<int> flog_level(FLOG_LEVEL_INFO);
+
+namespace {
+// Bounded multi-producer queue, a slot is free for position p when its
+// sequence is p, and holds a message when its sequence is p + 1.
+struct LogSlot {
+    std::atomic<size_t> sequence;
+    size_t length;
+    char text[LOG_SLOT_SIZE];
+};
+}
+
+static LogSlot log_ring[LOG_RING_SIZE];
+static std::atomic<size_t> log_enqueue_pos(0);
+static std::atomic<size_t> log_dequeue_pos(0);
+static std::atomic<bool> log_async(false);
+static std::atomic<bool> log_stop(false);
+static std::atomic<int> log_producers(0);
+static std::thread log_thread;
+static thread_local std::string log_job;
+
+static bool Enqueue(const char* text, size_t length) {
+    auto pos = log_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        auto& slot = log_ring[pos & (LOG_RING_SIZE - 1)];
+        auto diff = (intptr_t)slot.sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+            if (log_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                memcpy(slot.text, text, length);
+                slot.length = length;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // full
+        } else {
+            pos = log_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Write out everything queued, returns whether anything is written.
+static bool Drain() {
+    auto pos = log_dequeue_pos.load(std::memory_order_relaxed);
+    auto start = pos;
+    for (;;) {
+        auto& slot = log_ring[pos & (LOG_RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+            break;
+        }
+        fwrite(slot.text, 1, slot.length, stdout);
+        slot.sequence.store(pos + LOG_RING_SIZE, std::memory_order_release);
+        pos++;
+        log_dequeue_pos.store(pos, std::memory_order_release);
+    }
+    if (pos == start) {
+        return false;
+    }
+    fflush(stdout);
+    return true;
+}
+
+static void DrainLoop() {
+    unsigned idle = 0;
+    while (!log_stop.load(std::memory_order_acquire)) {
+        if (Drain()) {
+            idle = 0;
+        } else if (++idle < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    Drain();
+}
+
+// Wait until the messages queued so far are written.
+static void WaitDrained() {
+    auto target = log_enqueue_pos.load(std::memory_order_acquire);
+    while (log_dequeue_pos.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+static void WriteAsync(const char* text, size_t length) {
+    log_producers++;
+    if (!log_async.load(std::memory_order_acquire)) {
+        log_producers--;
+        fwrite(text, 1, length, stdout);
+        return;
+    }
+    if (length > LOG_SLOT_SIZE) {
+        // keep the order of messages of this thread
+        WaitDrained();
+        fwrite(text, 1, length, stdout);
+        fflush(stdout);
+    } else {
+        while (!Enqueue(text, length)) {
+            std::this_thread::yield();
+        }
+    }
+    log_producers--;
+}
+
+void FLogWrite(int level, const char* fmt, ...) {
+    (void)level;
+    char buf[LOG_SLOT_SIZE];
+    size_t prefix = 0;
+    if (!log_job.empty()) {
+        auto n = snprintf(buf, sizeof(buf), "[%s]", log_job.c_str());
+        prefix = n > 0 ? std::min<size_t>(n, sizeof(buf) - 1) : 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    va_list copy;
+    va_copy(copy, args);
+    auto n = vsnprintf(buf + prefix, sizeof(buf) - prefix, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        va_end(copy);
+        return;
+    }
+    if ((size_t)n < sizeof(buf) - prefix) {
+        va_end(copy);
+        WriteAsync(buf, prefix + n);
+        return;
+    }
+    std::string text(buf, prefix);
+    text.resize(prefix + n + 1);
+    vsnprintf(&text[prefix], n + 1, fmt, copy);
+    va_end(copy);
+    WriteAsync(text.data(), prefix + n);
+}
+
+void FLogStartAsync() {
+    if (log_async.load()) {
+        return;
+    }
+    fflush(stdout);
+    auto pos = log_enqueue_pos.load();
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        log_ring[(pos + i) & (LOG_RING_SIZE - 1)].sequence.store(pos + i, std::memory_order_relaxed);
+    }
+    log_dequeue_pos.store(pos);
+    log_stop = false;
+    log_thread = std::thread(DrainLoop);
+    log_async.store(true, std::memory_order_release);
+}
+
+void FLogStopAsync() {
+    if (!log_async.exchange(false)) {
+        return;
+    }
+    // messages being queued still have to be written
+    while (log_producers.load() != 0) {
+        std::this_thread::yield();
+    }
+    log_stop.store(true, std::memory_order_release);
+    log_thread.join();
+    fflush(stdout);
+}
+
+FLogJob::FLogJob(const std::string &name) : previous_(log_job) {
+    auto pos = name.find_last_of("/\\");
+    log_job = pos == std::string::npos ? name : name.substr(pos + 1);
+}
+
+FLogJob::~FLogJob() {
+    log_job = previous_;
+}
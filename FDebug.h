@@ -9,24 +9,90 @@
 #ifndef ANDDBG_ALOG_H
 #define ANDDBG_ALOG_H
 
-//#if !defined(NDEBUG)
-#if true
+#include <atomic>
+#include <string>
+
+#define FLOG_LEVEL_VERBOSE 0
+#define FLOG_LEVEL_DEBUG 1
+#define FLOG_LEVEL_INFO 2
+#define FLOG_LEVEL_WARN 3
+#define FLOG_LEVEL_ERROR 4
+#define FLOG_LEVEL_NONE 5
+
+// Levels below FLOG_MIN_LEVEL are not compiled in, levels above it are
+// filtered at runtime with FLogSetLevel.
+#ifndef FLOG_MIN_LEVEL
+#if defined(NDEBUG)
+#define FLOG_MIN_LEVEL FLOG_LEVEL_DEBUG
+#else
+#define FLOG_MIN_LEVEL FLOG_LEVEL_VERBOSE
+#endif
+#endif
+
+extern std::atomic<int> flog_level;
+
+inline bool FLogEnabled(int level) {
+    return level >= flog_level.load(std::memory_order_relaxed);
+}
+inline void FLogSetLevel(int level) {
+    flog_level.store(level, std::memory_order_relaxed);
+}
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void FLogWrite(int level, const char* fmt, ...);
+
+// Messages are queued in a ring buffer and written to stdout by a background
+// thread until FLogStopAsync, which writes out everything queued.  Without
+// the sink, messages are written directly.
+void FLogStartAsync();
+void FLogStopAsync();
+
+// Prefix the messages of the calling thread with the job name while alive.
+class FLogJob {
+public:
+    explicit FLogJob(const std::string& name);
+    ~FLogJob();
+
+private:
+    std::string previous_;
+};
 
 #define TOSTR(fmt) #fmt
 #define FLFMT TOSTR([%s:%d])
 #define FNLINE TOSTR(\n)
 
-#define FLOGE(fmt, ...) printf(FLFMT fmt FNLINE, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define FLOGD(fmt, ...) printf(FLFMT fmt FNLINE, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define FLOGW(fmt, ...) printf(FLFMT fmt FNLINE, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define FLOGI(fmt, ...) printf(FLFMT fmt FNLINE, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define FLOGV(fmt, ...) printf(FLFMT fmt FNLINE, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define FLOG_AT(level, fmt, ...) do { \
+        if (FLogEnabled(level)) { \
+            FLogWrite(level, FLFMT fmt FNLINE, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#if FLOG_MIN_LEVEL <= FLOG_LEVEL_ERROR
+#define FLOGE(fmt, ...) FLOG_AT(FLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define FLOGE(fmt, ...) do {} while (0)
+#endif
+#if FLOG_MIN_LEVEL <= FLOG_LEVEL_WARN
+#define FLOGW(fmt, ...) FLOG_AT(FLOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define FLOGW(fmt, ...) do {} while (0)
+#endif
+#if FLOG_MIN_LEVEL <= FLOG_LEVEL_INFO
+#define FLOGI(fmt, ...) FLOG_AT(FLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define FLOGI(fmt, ...) do {} while (0)
+#endif
+#if FLOG_MIN_LEVEL <= FLOG_LEVEL_DEBUG
+#define FLOGD(fmt, ...) FLOG_AT(FLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define FLOGD(fmt, ...) do {} while (0)
+#endif
+#if FLOG_MIN_LEVEL <= FLOG_LEVEL_VERBOSE
+#define FLOGV(fmt, ...) FLOG_AT(FLOG_LEVEL_VERBOSE, fmt, ##__VA_ARGS__)
 #else
-#define FLOGE(fmt, ...)
-#define FLOGD(fmt, ...)
-#define FLOGW(fmt, ...)
-#define FLOGI(fmt, ...)
-#define FLOGV(fmt, ...)
+#define FLOGV(fmt, ...) do {} while (0)
 #endif
 
 #endif //ANDDBG_ALOG_H
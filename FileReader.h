@@ -12,10 +12,25 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define SOFIXER_HAVE_FD_READER 1
+#endif
 
 class FileReader {
 public:
     FileReader(const char* name): source(name){}
+    // Read from an opened file descriptor(e.g. memfd sent by dumper), the
+    // descriptor is not owned by reader.
+    FileReader(const char* name, int fd): source(name), fd(fd) {}
+    // Read from memory, data is not owned by reader.
+    FileReader(const char* name, const void* data, size_t size)
+            : source(name), file_size(size), map(reinterpret_cast<const uint8_t*>(data)) {}
     ~FileReader() {
         Close();
     }
@@ -23,6 +38,14 @@ public:
         if (IsValid()) {
             return false;
         }
+        if (map != nullptr) {
+            pos = 0;
+            direct_opened = true;
+            return true;
+        }
+        if (fd >= 0) {
+            return OpenFd();
+        }
         fp = fopen(source, "rb");
         if (fp == nullptr) {
             return false;
@@ -33,6 +56,14 @@ public:
         return true;
     }
     bool Close() {
+#ifdef SOFIXER_HAVE_FD_READER
+        if (map_owned) {
+            munmap((void*)map, file_size);
+            map = nullptr;
+            map_owned = false;
+        }
+#endif
+        direct_opened = false;
         if (IsValid()) {
             auto err = fclose(fp);
             fp = nullptr;
@@ -41,16 +72,20 @@ public:
         return false;
     }
     bool IsValid() {
-        return fp != nullptr;
+        return fp != nullptr || direct_opened;
     }
     const char* getSource() {
         return source;
     }
     size_t Read(void *addr, size_t len, int offset = -1) {
+        if (direct_opened) {
+            return ReadDirect(addr, len, offset);
+        }
         if (offset >= 0) {
             fseek(fp, offset, SEEK_SET);
         }
         auto rc = TEMP_FAILURE_RETRY(fread(addr, 1, len, fp));
+        bytes_read += rc;
 
         if (rc < 0) {
             FLOGE("can't read file \"%s\": %s", source, strerror(errno));
@@ -65,10 +100,99 @@ public:
     long FileSize() {
         return file_size;
     }
+    size_t BytesRead() {
+        return bytes_read;
+    }
+    // Map length bytes of file at offset to addr copy on write, the pages are
+    // read when touched. Memory source can not be mapped.
+    bool MapPrivate(void* addr, size_t length, size_t offset) {
+#ifdef SOFIXER_HAVE_FD_READER
+        auto file = fd >= 0 ? fd : fp != nullptr ? fileno(fp) : -1;
+        if (file < 0 || (map != nullptr && !map_owned)) {
+            FLOGE("\"%s\" is not a file, unable to map it", source);
+            return false;
+        }
+        if (mmap(addr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file, offset) == MAP_FAILED) {
+            FLOGE("can't map file \"%s\": %s", source, strerror(errno));
+            return false;
+        }
+        return true;
+#else
+        FLOGE("mapping file is not supported on this platform");
+        return false;
+#endif
+    }
 private:
+#ifdef SOFIXER_HAVE_FD_READER
+    bool OpenFd() {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            FLOGE("can't stat file \"%s\": %s", source, strerror(errno));
+            return false;
+        }
+        file_size = st.st_size;
+        pos = 0;
+        direct_opened = true;
+        // Map the data directly if it can not shrink(a sealed memfd), or
+        // reading the mapping may raise SIGBUS.
+#ifdef F_SEAL_SHRINK
+        auto seals = fcntl(fd, F_GET_SEALS);
+        if (seals >= 0 && (seals & F_SEAL_SHRINK) != 0 && file_size > 0) {
+            auto m = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (m != MAP_FAILED) {
+                map = reinterpret_cast<const uint8_t*>(m);
+                map_owned = true;
+            }
+        }
+#endif
+        return true;
+    }
+#else
+    bool OpenFd() {
+        FLOGE("reading from file descriptor is not supported on this platform");
+        return false;
+    }
+#endif
+    size_t ReadDirect(void *addr, size_t len, int offset) {
+        if (offset >= 0) {
+            pos = offset;
+        }
+        size_t rc = 0;
+        if (map != nullptr) {
+            rc = pos < (size_t)file_size ? std::min(len, (size_t)file_size - pos) : 0;
+            memcpy(addr, map + pos, rc);
+        } else {
+#ifdef SOFIXER_HAVE_FD_READER
+            while (rc < len) {
+                auto n = TEMP_FAILURE_RETRY(pread(fd, (uint8_t*)addr + rc, len - rc, pos + rc));
+                if (n < 0) {
+                    FLOGE("can't read file \"%s\": %s", source, strerror(errno));
+                    return rc;
+                }
+                if (n == 0) break;
+                rc += n;
+            }
+#endif
+        }
+        pos += rc;
+        bytes_read += rc;
+        if (rc != len) {
+            FLOGE("\"%s\" has no enough data at %x:%zx, not a valid file or you need to dump more data", source, offset, len);
+        }
+        return rc;
+    }
+
     FILE* fp = nullptr;
     const char* source = nullptr;
     long file_size;
+
+    // file descriptor or memory source
+    int fd = -1;
+    bool direct_opened = false;
+    const uint8_t* map = nullptr;
+    bool map_owned = false;
+    size_t pos = 0;
+    size_t bytes_read = 0;
 };
 
 #endif //SOFIXER_FILEREADER_H
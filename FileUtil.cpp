@@ -0,0 +1,72 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "FileUtil.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+bool MakeDir(const std::string& dir) {
+#ifdef _WIN32
+    auto rc = mkdir(dir.c_str());
+#else
+    auto rc = mkdir(dir.c_str(), 0755);
+#endif
+    return rc == 0 || errno == EEXIST;
+}
+
+std::string AbsolutePath(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+    char cwd[4096];
+    if (!path.empty() && path[0] != '/' && getcwd(cwd, sizeof(cwd)) != nullptr) {
+        return std::string(cwd) + "/" + path;
+    }
+#endif
+    return path;
+}
+
+bool MoveReplace(const std::string& from, const std::string& path) {
+#ifdef _WIN32
+    // rename fails on windows if path exists
+    return MoveFileExA(from.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), path.c_str()) == 0;
+#endif
+}
+
+std::string TempPath(const std::string& path) {
+    static std::atomic<unsigned> sequence(0);
+    auto temp = path + ".tmp" + std::to_string(sequence++);
+#if defined(__unix__) || defined(__APPLE__)
+    temp += "." + std::to_string(getpid());
+#endif
+    return temp;
+}
+
+bool WriteFileAtomic(const std::string& path, const void* data, size_t size, bool read_only) {
+    auto temp = TempPath(path);
+    auto fp = fopen(temp.c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    auto ok = fwrite(data, 1, size, fp) == size;
+    ok = fclose(fp) == 0 && ok;
+    if (ok && read_only) {
+        chmod(temp.c_str(), 0444);
+    }
+    if (!ok || !MoveReplace(temp, path)) {
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
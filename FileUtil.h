@@ -0,0 +1,29 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// File helpers shared by the on-disk stores
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_FILEUTIL_H
+#define SOFIXER_FILEUTIL_H
+
+#include <cstddef>
+#include <string>
+
+// Create dir if it does not exist, the parent must exist.
+bool MakeDir(const std::string& dir);
+
+// path prefixed with the current directory if it is relative.
+std::string AbsolutePath(const std::string& path);
+
+// Rename from to path, replacing path if it exists. Returns false on error.
+bool MoveReplace(const std::string& from, const std::string& path);
+
+// Unique name next to path to write a file renamed to path when complete.
+std::string TempPath(const std::string& path);
+
+// Write data to a temporary file and rename it to path, so readers never see
+// partial data. The file is made read only if read_only is set.
+bool WriteFileAtomic(const std::string& path, const void* data, size_t size,
+                     bool read_only = false);
+
+#endif //SOFIXER_FILEUTIL_H
@@ -0,0 +1,604 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "Fixer.h"
+#include "ObElfReader.h"
+#include "ElfRebuilder.h"
+#include "FDebug.h"
+#include "FileReader.h"
+#include "FileUtil.h"
+#include "Hash.h"
+#include "Refix.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <vector>
+#include <sys/stat.h>
+
+static bool WriteFully(int fd, const void* data, size_t size) {
+#ifdef SOFIXER_HAVE_FD_READER
+    auto p = reinterpret_cast<const uint8_t*>(data);
+    while (size != 0) {
+        auto n = TEMP_FAILURE_RETRY(write(fd, p, size));
+        if (n <= 0) {
+            FLOGE("write failed: %s", strerror(errno));
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Fail if the relocations left unfixed are over the limits of options.
+static bool CheckRelocs(const ElfRebuilder& elf_rebuilder, const FixOptions& options) {
+    if (options.max_skipped_relocs < 0 && options.max_unresolved_relocs < 0) {
+        return true;
+    }
+    RelocHistogram::Counts total;
+    for (int t = 0; t < RELOC_TABLE_COUNT; t++) {
+        auto counts = elf_rebuilder.getRelocHistogram((RelocTable)t).Total();
+        for (int i = 0; i < RELOC_OUTCOME_COUNT; i++) {
+            total.outcomes[i] += counts.outcomes[i];
+        }
+    }
+    if (total.processed() == 0) {
+        return true;
+    }
+    const double limits[RELOC_OUTCOME_COUNT] = {-1, options.max_skipped_relocs, options.max_unresolved_relocs};
+    bool passed = true;
+    for (int i = 0; i < RELOC_OUTCOME_COUNT; i++) {
+        auto percent = 100.0 * total.outcomes[i] / total.processed();
+        if (limits[i] >= 0 && percent > limits[i]) {
+            FLOGE("%.2f%% of %llu relocations are %s, more than %.2f%%", percent,
+                  (unsigned long long)total.processed(), RelocOutcomeName(i), limits[i]);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+// Load the opened source and rebuild it, in windows passed to write if it is
+// set.
+static bool RebuildSo(ObElfReader& elf_reader, ElfRebuilder& elf_rebuilder,
+                      const FixOptions& options,
+                      const std::function<bool(const void*, size_t)>& write = nullptr) {
+    elf_reader.setDumpSoBaseAddr(options.dump_base);
+    if (!options.baseso.empty()) {
+        elf_reader.setBaseSoName(options.baseso.c_str());
+        elf_reader.setBaseSoCache(options.baseso_cache);
+    }
+    elf_reader.setStats(options.stats);
+    elf_rebuilder.setStats(options.stats);
+    elf_rebuilder.setArena(options.arena);
+    elf_reader.setImagePool(options.image_pool);
+    elf_rebuilder.setImagePool(options.image_pool);
+
+    if(!elf_reader.Load()) {
+        FLOGE("source so file is invalid");
+        return false;
+    }
+
+    elf_rebuilder.setCompactLayout(options.compact);
+    auto rebuilt = write ? elf_rebuilder.RebuildWindowed(options.window_size, write) :
+                   elf_rebuilder.Rebuild();
+    if(!rebuilt) {
+        FLOGE("error occured in rebuilding elf file");
+        return false;
+    }
+    return CheckRelocs(elf_rebuilder, options);
+}
+
+static void FinishResult(FixResult* result, size_t source_size, size_t output_size,
+                         std::chrono::steady_clock::time_point start) {
+    if (result != nullptr) {
+        result->source_size = source_size;
+        result->output_size = output_size;
+        result->elapsed = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+// Name of the output in page store, the full path so that the same library
+// fixed to different directories is kept apart.
+static std::string PageStoreName(const FixOptions& options) {
+    auto& path = options.output.empty() || options.output == "-" ? options.source : options.output;
+    return AbsolutePath(path);
+}
+
+bool WriteFixOutput(const FixOptions& options, const void* data, size_t size) {
+    PhaseTimer timer(options.stats, "write");
+    if (options.stats != nullptr) {
+        options.stats->bytes_written += size;
+    }
+    if (options.page_store != nullptr &&
+        !options.page_store->Put(PageStoreName(options), data, size)) {
+        return false;
+    }
+    if (options.output_fd >= 0) {
+        if (!WriteFully(options.output_fd, data, size)) {
+            FLOGE("output so file cannot write !!!");
+            return false;
+        }
+    } else if (!options.output.empty()) {
+        // replace the file instead of writing it in place, an output fetched
+        // from result cache is a hardlink of the cache entry
+        if (!WriteFileAtomic(options.output, data, size)) {
+            FLOGE("output so file cannot write !!!");
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ReadWholeFile(const char* name, int fd, std::vector<uint8_t>* data) {
+    FileReader path_reader(name);
+    FileReader fd_reader(name, fd);
+    auto& reader = fd >= 0 ? fd_reader : path_reader;
+    if (!reader.Open()) {
+        return false;
+    }
+    data->resize(reader.FileSize());
+    return data->empty() || reader.Read(data->data(), data->size(), 0) == data->size();
+}
+
+bool ReadFixSource(const FixOptions& options, std::vector<uint8_t>* data) {
+    PhaseTimer timer(options.stats, "read");
+    if (!ReadWholeFile(options.source.c_str(), options.source_fd, data)) {
+        return false;
+    }
+    if (options.stats != nullptr) {
+        options.stats->bytes_read += data->size();
+    }
+    return true;
+}
+
+// Hash of the base so content, 0 if there is no base so. The base so is
+// parsed into job->baseso_cache, or local_cache if job has no cache.
+static bool HashBaseSo(FixOptions* job, BaseSoCache* local_cache, uint64_t* hash) {
+    *hash = 0;
+    if (job->baseso.empty()) {
+        return true;
+    }
+    if (job->baseso_cache == nullptr) {
+        job->baseso_cache = local_cache;
+    }
+    auto info = job->baseso_cache->Get(job->baseso.c_str());
+    if (info == nullptr) {
+        FLOGE("unable to load base so file %s", job->baseso.c_str());
+        return false;
+    }
+    *hash = info->hash;
+    return true;
+}
+
+// Everything except the dump that changes the output.
+static uint64_t OptionsHash(const FixOptions& options, uint64_t baseso_hash) {
+    std::ostringstream salt;
+    salt << SOFIXER_VERSION << ' ' << SOFIXER_OUTPUT_REVISION << ' ' << sizeof(Elf_Addr) << ' '
+         << options.dump_base << ' ' << options.compact << ' ' << baseso_hash;
+    // outputs are reused only by jobs with the same relocation limits
+    if (options.max_skipped_relocs >= 0 || options.max_unresolved_relocs >= 0) {
+        salt << ' ' << options.max_skipped_relocs << ' ' << options.max_unresolved_relocs;
+    }
+    auto text = salt.str();
+    return HashData(text.data(), text.size());
+}
+
+static uint64_t ResultKey(const std::vector<uint8_t>& dump, const FixOptions& options,
+                          uint64_t baseso_hash) {
+    return HashData(dump.data(), dump.size(), OptionsHash(options, baseso_hash));
+}
+
+// Seed of the second dump hash of result cache, a fixed value unrelated to
+// the options hash ResultKey is seeded with.
+#define RESULT_CHECK_SEED 0x736f666978657221ULL
+
+static ResultCheck ResultSourceCheck(const std::vector<uint8_t>& dump, const FixOptions& options,
+                                     uint64_t baseso_hash) {
+    ResultCheck check = {dump.size(), HashData(dump.data(), dump.size(), RESULT_CHECK_SEED),
+                         OptionsHash(options, baseso_hash)};
+    return check;
+}
+
+// Fix with the result cache: take the stored output of the same input, or
+// fix it in memory and store the output.
+static bool FixSoFileCached(const FixOptions& options, FixResult* result,
+                            std::chrono::steady_clock::time_point start) {
+    std::vector<uint8_t> dump;
+    if (!ReadFixSource(options, &dump)) {
+        FLOGE("unable to open source file");
+        return false;
+    }
+
+    auto job = options;
+    BaseSoCache local_cache;
+    uint64_t baseso_hash;
+    if (!HashBaseSo(&job, &local_cache, &baseso_hash)) {
+        return false;
+    }
+
+    auto key = ResultKey(dump, job, baseso_hash);
+    auto check = ResultSourceCheck(dump, job, baseso_hash);
+    size_t output_size = 0;
+    bool hit;
+    if (job.page_store != nullptr) {
+        // the output has to be in memory to be put in page store
+        std::vector<uint8_t> output;
+        hit = job.result_cache->Load(key, check, &output);
+        if (hit && !WriteFixOutput(job, output.data(), output.size())) {
+            return false;
+        }
+        output_size = output.size();
+    } else {
+        hit = job.result_cache->Fetch(key, check, job.output_fd >= 0 ? std::string() : job.output,
+                                      job.output_fd, &output_size);
+    }
+    if (hit) {
+        FLOGI("%s is taken from result cache %s", job.source.c_str(), HashToString(key).c_str());
+        FinishResult(result, dump.size(), output_size, start);
+        if (result != nullptr) {
+            result->cached = true;
+        }
+        return true;
+    }
+
+    FixBuffer output;
+    if (!FixSoBuffer(dump.data(), dump.size(), job, &output, nullptr)) {
+        return false;
+    }
+    if (!WriteFixOutput(job, output.data.get(), output.size)) {
+        return false;
+    }
+    job.result_cache->Store(key, check, output.data.get(), output.size);
+    FinishResult(result, dump.size(), output.size, start);
+    return true;
+}
+
+// Fix against the previous output of the same library, only the pages
+// changed since then are patched. Falls back to a full rebuild if the
+// previous output can not be used.
+static bool FixSoFileIncremental(const FixOptions& options, FixResult* result,
+                                 std::chrono::steady_clock::time_point start) {
+    std::vector<uint8_t> dump;
+    if (!ReadFixSource(options, &dump)) {
+        FLOGE("unable to open source file");
+        return false;
+    }
+    auto job = options;
+    BaseSoCache local_cache;
+    uint64_t baseso_hash;
+    if (!HashBaseSo(&job, &local_cache, &baseso_hash)) {
+        return false;
+    }
+
+    RefixMeta current;
+    current.options = OptionsHash(job, baseso_hash);
+    current.source_size = dump.size();
+    current.pages = HashDumpPages(dump.data(), dump.size());
+
+    RefixMeta meta;
+    std::vector<uint8_t> refixed;
+    FixBuffer rebuilt;
+    const uint8_t* output = nullptr;
+    size_t output_size = 0;
+    if (!job.previous.empty()) {
+        PhaseTimer timer(job.stats, "refix");
+        if (!meta.Load(job.previous + REFIX_SUFFIX)) {
+            FLOGI("no refix data of %s, rebuild all", job.previous.c_str());
+        } else if (!ReadWholeFile(job.previous.c_str(), -1, &refixed)) {
+            FLOGE("unable to read previous output %s", job.previous.c_str());
+        } else if (RefixOutput(meta, current, dump.data(), &refixed)) {
+            meta.pages = current.pages;
+            output = refixed.data();
+            output_size = refixed.size();
+        }
+    }
+    if (output == nullptr) {
+        ObElfReader elf_reader;
+        ElfRebuilder elf_rebuilder(&elf_reader);
+        elf_reader.setArena(job.arena);
+        if (!elf_reader.setSource(job.source.c_str(), dump.data(), dump.size())) {
+            FLOGE("unable to open source data");
+            return false;
+        }
+        if (!RebuildSo(elf_reader, elf_rebuilder, job)) {
+            return false;
+        }
+        meta = RefixMeta();
+        elf_rebuilder.CollectRefixMeta(&meta);
+        meta.options = current.options;
+        meta.pages = current.pages;
+        rebuilt.size = elf_rebuilder.getRebuildSize();
+        rebuilt.data = elf_rebuilder.releaseRebuildData();
+        output = rebuilt.data.get();
+        output_size = rebuilt.size;
+    }
+
+    if (!WriteFixOutput(job, output, output_size)) {
+        return false;
+    }
+    meta.output_hash = HashData(output, output_size);
+    if (job.output_fd < 0 && !job.output.empty() && !meta.Save(job.output + REFIX_SUFFIX)) {
+        FLOGE("unable to write refix data of %s", job.output.c_str());
+    }
+    FinishResult(result, dump.size(), output_size, start);
+    return true;
+}
+
+// Fix a dump larger than memory, the source is mapped instead of read and
+// every window is written before the next one is touched.
+static bool FixSoFileWindowed(const FixOptions& options, FixResult* result,
+                              std::chrono::steady_clock::time_point start) {
+    // segments are expanded to the dump only with the base address
+    if (options.dump_base == 0) {
+        FLOGE("memory base address(-m) is required to fix in windows");
+        return false;
+    }
+    if (options.compact || options.page_store != nullptr || options.result_cache != nullptr ||
+        !options.previous.empty() || options.save_refix) {
+        FLOGE("compact layout, page store, result cache and refix can not be used to fix in windows");
+        return false;
+    }
+    ObElfReader elf_reader;
+    ElfRebuilder elf_rebuilder(&elf_reader);
+
+    FLOGI("start to rebuild elf file in windows of %zu bytes", options.window_size);
+    elf_reader.setArena(options.arena);
+    elf_reader.setMapSource(true);
+    auto opened = options.source_fd >= 0 ?
+                  elf_reader.setSource(options.source.c_str(), options.source_fd) :
+                  elf_reader.setSource(options.source.c_str());
+    if (!opened) {
+        FLOGE("unable to open source file");
+        return false;
+    }
+
+    // written to a temporary file renamed to output when all windows are
+    // written, so a failed job leaves no output
+    auto temp = options.output.empty() ? std::string() : TempPath(options.output);
+    FILE* file = nullptr;
+    size_t written = 0;
+    auto write = [&](const void* data, size_t size) {
+        written += size;
+        if (options.output_fd >= 0) {
+            return WriteFully(options.output_fd, data, size);
+        }
+        if (options.output.empty()) {
+            return true;
+        }
+        if (file == nullptr && (file = fopen(temp.c_str(), "wb")) == nullptr) {
+            FLOGE("output so file cannot write !!!");
+            return false;
+        }
+        if (fwrite(data, 1, size, file) != size) {
+            FLOGE("write failed: %s", strerror(errno));
+            return false;
+        }
+        return true;
+    };
+    auto ok = RebuildSo(elf_reader, elf_rebuilder, options, write);
+    if (file != nullptr && fclose(file) != 0) {
+        FLOGE("write failed: %s", strerror(errno));
+        ok = false;
+    }
+    if (file != nullptr && ok && !MoveReplace(temp, options.output)) {
+        FLOGE("output so file cannot write !!!");
+        ok = false;
+    }
+    if (!ok) {
+        if (file != nullptr) {
+            remove(temp.c_str());
+        }
+        return false;
+    }
+    if (options.stats != nullptr) {
+        // mapped pages are not counted by the reader
+        options.stats->bytes_read += elf_reader.source_size();
+        options.stats->bytes_written += written;
+    }
+    FinishResult(result, elf_reader.source_size(), written, start);
+    return true;
+}
+
+bool FixSoFile(const FixOptions& options, FixResult* result) {
+    auto start = std::chrono::steady_clock::now();
+    if (options.window_size != 0) {
+        return FixSoFileWindowed(options, result, start);
+    }
+    if (!options.previous.empty() || options.save_refix) {
+        return FixSoFileIncremental(options, result, start);
+    }
+    if (options.result_cache != nullptr) {
+        return FixSoFileCached(options, result, start);
+    }
+    ObElfReader elf_reader;
+    ElfRebuilder elf_rebuilder(&elf_reader);
+
+    FLOGI("start to rebuild elf file");
+    elf_reader.setArena(options.arena);
+    auto opened = options.source_fd >= 0 ?
+                  elf_reader.setSource(options.source.c_str(), options.source_fd) :
+                  elf_reader.setSource(options.source.c_str());
+    if (!opened) {
+        FLOGE("unable to open source file");
+        return false;
+    }
+    if (!RebuildSo(elf_reader, elf_rebuilder, options)) {
+        return false;
+    }
+
+    if (options.stats != nullptr) {
+        options.stats->bytes_read += elf_reader.source_bytes_read();
+    }
+    if (!WriteFixOutput(options, elf_rebuilder.getRebuildData(), elf_rebuilder.getRebuildSize())) {
+        return false;
+    }
+    FinishResult(result, elf_reader.source_size(), elf_rebuilder.getRebuildSize(), start);
+    return true;
+}
+
+bool RestoreSoFile(const FixOptions& options, const std::string& name) {
+    std::vector<uint8_t> output;
+    if (options.page_store == nullptr || !options.page_store->Get(AbsolutePath(name), &output)) {
+        return false;
+    }
+    auto job = options;
+    job.page_store = nullptr;
+    return WriteFixOutput(job, output.data(), output.size());
+}
+
+bool FixSoBuffer(const void* dump, size_t dump_size, const FixOptions& options,
+                 FixBuffer* output, FixResult* result) {
+    auto start = std::chrono::steady_clock::now();
+    ObElfReader elf_reader;
+    ElfRebuilder elf_rebuilder(&elf_reader);
+
+    auto name = options.source.empty() ? "memory" : options.source.c_str();
+    elf_reader.setArena(options.arena);
+    if (!elf_reader.setSource(name, dump, dump_size)) {
+        FLOGE("unable to open source data");
+        return false;
+    }
+    if (!RebuildSo(elf_reader, elf_rebuilder, options)) {
+        return false;
+    }
+
+    output->size = elf_rebuilder.getRebuildSize();
+    output->data = elf_rebuilder.releaseRebuildData();
+    FinishResult(result, dump_size, output->size, start);
+    return true;
+}
+
+bool ParseFixJob(const std::string& line, FixOptions* job) {
+    std::istringstream fields(line);
+    std::string base;
+    if (!(fields >> job->source) || !(fields >> job->output)) {
+        return false;
+    }
+    if (fields >> base) {
+        job->dump_base = ParseDumpBase(base.c_str());
+    }
+    fields >> job->baseso;
+    return true;
+}
+
+size_t EstimateFixMemory(const FixOptions& options) {
+    ObElfReader elf_reader;
+    elf_reader.setDumpSoBaseAddr(options.dump_base);
+    elf_reader.setImagePool(options.image_pool);
+    if (!elf_reader.setSource(options.source.c_str())) {
+        return 0;
+    }
+    if (!options.baseso.empty()) {
+        elf_reader.setBaseSoName(options.baseso.c_str());
+        elf_reader.setBaseSoCache(options.baseso_cache);
+    }
+    auto estimate = elf_reader.EstimateMemory();
+    if (estimate == 0) {
+        return 0;
+    }
+    if (options.window_size != 0) {
+        // a window of image and a copy of it scanned for .bss, and the
+        // relocations waiting for their window
+        return std::min(estimate, 2 * options.window_size) +
+               ElfRebuilder::WindowRelocMemory(elf_reader.EstimateRelocations());
+    }
+    // batch pipeline, result cache and refix read the whole dump, and refix
+    // also the previous output, they are kept next to the image
+    estimate += elf_reader.source_size();
+    struct stat st;
+    if (!options.previous.empty() && stat(options.previous.c_str(), &st) == 0) {
+        estimate += st.st_size;
+    }
+    return estimate;
+}
+
+int CreateOutputMemfd(const char* name) {
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+    auto fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        FLOGE("unable to create memfd: %s", strerror(errno));
+    }
+    return fd;
+#else
+    FLOGE("memfd is not supported on this platform");
+    return -1;
+#endif
+}
+
+bool SealOutputMemfd(int fd) {
+#if defined(__linux__) && defined(F_SEAL_SEAL)
+    lseek(fd, 0, SEEK_SET);
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        FLOGE("unable to seal output memfd: %s", strerror(errno));
+        return false;
+    }
+    return true;
+#else
+    FLOGE("memfd is not supported on this platform");
+    return false;
+#endif
+}
+
+bool ParseSize(const char* c, size_t* size) {
+    if (!isdigit((unsigned char)*c)) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    auto value = strtoull(c, &end, 10);
+    if (errno != 0 || value > SIZE_MAX) {
+        return false;
+    }
+    unsigned shift = 0;
+    switch (*end) {
+        case 'g': case 'G': shift += 10;
+            // fallthrough
+        case 'm': case 'M': shift += 10;
+            // fallthrough
+        case 'k': case 'K': shift += 10;
+            end++;
+            break;
+        default: break;
+    }
+    if (*end != 0 || value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    *size = (size_t)value << shift;
+    return true;
+}
+
+Elf_Addr ParseDumpBase(const char* c) {
+    auto is16Bit = [](const char* c) {
+        auto len = strlen(c);
+        if(len > 2) {
+            if(c[0] == '0' & c[1] == 'x') return true;
+        }
+        bool is10bit = true;
+        for(auto i = 0; i < len; i++) {
+            if((c[i] > 'a' && c[i] < 'f') ||
+               (c[i] > 'A' && c[i] < 'F')) {
+                is10bit = false;
+            }
+        }
+        return !is10bit;
+    };
+#ifndef __SO64__
+    return strtoul(c, 0, is16Bit(c) ? 16: 10);
+#else
+    return strtoull(c, 0, is16Bit(c) ? 16: 10);
+#endif
+}
@@ -0,0 +1,121 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Fix a single dumped so file
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_FIXER_H
+#define SOFIXER_FIXER_H
+
+#define SOFIXER_VERSION "2.1"
+// Bump when the output rebuilt from the same dump and options changes, so
+// that result cache entries and refix data of older builds are not reused.
+#define SOFIXER_OUTPUT_REVISION 3
+
+#include "macros.h"
+#include "BaseSoCache.h"
+#include "ResultCache.h"
+#include "PageStore.h"
+#include "Stats.h"
+#include "JobArena.h"
+#include "ImagePool.h"
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+struct FixOptions {
+    std::string source;
+    std::string output;
+    std::string baseso;
+    // the memory address which the source so is dump from
+    Elf_Addr dump_base = 0;
+    bool compact = false;
+    // fail the job if more than the percent of relocations are skipped for
+    // unknown type, or point to symbols not in the library, -1 to allow all
+    double max_skipped_relocs = -1;
+    double max_unresolved_relocs = -1;
+    // read source from / write output to file descriptor instead of path,
+    // descriptors are not closed.
+    int source_fd = -1;
+    int output_fd = -1;
+    // shared by jobs of batch and serve mode
+    BaseSoCache* baseso_cache = nullptr;
+    // outputs of the same input and options are taken from cache if set
+    ResultCache* result_cache = nullptr;
+    // outputs are also kept in page store, named after the output file
+    PageStore* page_store = nullptr;
+    // fix incrementally against a previous output of the same library, and
+    // save output.refix for the next run(also saved if save_refix is set)
+    std::string previous;
+    bool save_refix = false;
+    // time of phases and counters of the job are recorded if set
+    FixStats* stats = nullptr;
+    // small allocations of the job are taken from arena if set, the owner
+    // resets it after the job is finished
+    JobArena* arena = nullptr;
+    // loaded and rebuilt images are taken from pool if set
+    ImagePool* image_pool = nullptr;
+    // back large images of the pool created by batch and serve mode with
+    // huge pages
+    bool huge_pages = false;
+    // map the source and rebuild it in windows of the size, written one by
+    // one, for dumps larger than memory, 0 to load the whole image
+    size_t window_size = 0;
+};
+
+struct FixResult {
+    size_t source_size = 0;
+    size_t output_size = 0;
+    // wall time in milliseconds
+    double elapsed = 0;
+    // output is taken from result cache
+    bool cached = false;
+};
+
+// Every call owns its ObElfReader and ElfRebuilder, so jobs can be fixed
+// on many threads at the same time.
+bool FixSoFile(const FixOptions& options, FixResult* result = nullptr);
+
+// Fixed image owned by caller.
+struct FixBuffer {
+    ImageBuffer data;
+    size_t size = 0;
+};
+
+// Fix the dumped so in memory, options.source is used as name in log and
+// output paths are ignored. The dump is not modified.
+bool FixSoBuffer(const void* dump, size_t dump_size, const FixOptions& options,
+                 FixBuffer* output, FixResult* result = nullptr);
+
+// Stages of FixSoFile, so that reading, fixing and writing of different jobs
+// can be overlapped. The whole source is read into dump, output is written to
+// options.output or options.output_fd and put in options.page_store.
+bool ReadFixSource(const FixOptions& options, std::vector<uint8_t>* dump);
+bool WriteFixOutput(const FixOptions& options, const void* data, size_t size);
+
+// Reassemble output stored as name(the output path it is fixed to) in
+// options.page_store and write it to options.output or options.output_fd.
+bool RestoreSoFile(const FixOptions& options, const std::string& name);
+
+// Parse job line "source output [memBaseAddr] [baseSoPath]", fields not in
+// line are kept. Returns false if source or output is missing.
+bool ParseFixJob(const std::string& line, FixOptions* job);
+
+// Memory needed to fix options.source in batch mode(including the dump read
+// into memory), 0 if it is not a valid elf file.
+size_t EstimateFixMemory(const FixOptions& options);
+
+// Create an empty memfd for fixed output, -1 if not supported.
+int CreateOutputMemfd(const char* name);
+// Seal memfd so that the receiver can map it safely. Returns false if it
+// can not be sealed.
+bool SealOutputMemfd(int fd);
+
+// Parse memory address in 16bit(0x prefix or a-f found) or 10bit format.
+Elf_Addr ParseDumpBase(const char* c);
+
+// Parse size in 10bit format with K/M/G suffix. Returns false if c is not a
+// size or the size overflows.
+bool ParseSize(const char* c, size_t* size);
+
+#endif //SOFIXER_FIXER_H
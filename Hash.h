@@ -0,0 +1,18 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Fast non-cryptographic content hash(XXH64)
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_HASH_H
+#define SOFIXER_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+uint64_t HashData(const void* data, size_t size, uint64_t seed = 0);
+
+// 16 hex characters of hash
+std::string HashToString(uint64_t hash);
+
+#endif //SOFIXER_HASH_H
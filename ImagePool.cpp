@@ -0,0 +1,225 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "ImagePool.h"
+#include "FDebug.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define SOFIXER_HAVE_MMAP 1
+#endif
+
+// smallest class, and the granularity of classes
+static const size_t kMinClassSize = 64 << 10;
+static const size_t kClassAlign = 4096;
+static const size_t kHugePageSize = 2 << 20;
+
+static uint8_t* MapImage(size_t size) {
+#ifdef SOFIXER_HAVE_MMAP
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        FLOGE("unable to map image of %zu bytes: %s", size, strerror(errno));
+        throw std::bad_alloc();
+    }
+    return static_cast<uint8_t*>(p);
+#else
+    return new uint8_t[size];
+#endif
+}
+
+// Map size bytes aligned to huge page, and ask for huge pages.
+static uint8_t* MapHugeImage(size_t size) {
+#ifdef SOFIXER_HAVE_MMAP
+    // map a huge page more, and trim both ends to the alignment
+    auto p = MapImage(size + kHugePageSize);
+    auto start = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(p) + kHugePageSize - 1) &
+                                            ~(uintptr_t)(kHugePageSize - 1));
+    if (start != p) {
+        munmap(p, start - p);
+    }
+    auto tail = (p + size + kHugePageSize) - (start + size);
+    if (tail != 0) {
+        munmap(start + size, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, size, MADV_HUGEPAGE) != 0) {
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true)) {
+            FLOGW("unable to use huge pages for images: %s", strerror(errno));
+        }
+    }
+#endif
+    return start;
+#else
+    return MapImage(size);
+#endif
+}
+
+static void UnmapImage(uint8_t* data, size_t size) {
+#ifdef SOFIXER_HAVE_MMAP
+    munmap(data, size);
+#else
+    delete[] data;
+#endif
+}
+
+// Let the kernel take the pages of a kept buffer when it needs them.
+static void ResetImage(uint8_t* data, size_t size) {
+#ifdef SOFIXER_HAVE_MMAP
+#ifdef MADV_FREE
+    static std::atomic<bool> free_supported(true);
+    if (free_supported.load(std::memory_order_relaxed)) {
+        if (madvise(data, size, MADV_FREE) == 0) {
+            return;
+        }
+        // kernel older than 4.5
+        free_supported = false;
+    }
+#endif
+    madvise(data, size, MADV_DONTNEED);
+#endif
+}
+
+ImagePool::ImagePool(size_t max_cached) : max_cached_(max_cached) {
+}
+
+ImagePool::~ImagePool() {
+    for (auto& sized : free_) {
+        for (auto data : sized.second) {
+            UnmapImage(data, sized.first);
+        }
+    }
+    FLOGD("image pool: %zu hits, %zu misses", hits_, misses_);
+}
+
+size_t ImagePool::ClassSize(size_t size) {
+    if (size <= kMinClassSize) {
+        return kMinClassSize;
+    }
+    size_t power = kMinClassSize;
+    while (power <= (size - 1) / 2) {
+        power <<= 1;
+    }
+    // a quarter of the power of two below, so at most a quarter is wasted
+    auto step = std::max(power / 4, kClassAlign);
+    return (size + step - 1) / step * step;
+}
+
+bool ImagePool::setHugePages(bool enable) {
+    huge_pages_ = false;
+    if (!enable) {
+        return true;
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // [always] or [madvise] is selected, huge pages are never used with [never]
+    auto fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    char mode[128] = {0};
+    if (fp != nullptr) {
+        if (fgets(mode, sizeof(mode), fp) == nullptr) {
+            mode[0] = 0;
+        }
+        fclose(fp);
+    }
+    if (strstr(mode, "[never]") != nullptr || fp == nullptr) {
+        FLOGW("transparent huge pages are disabled, images use normal pages");
+        return false;
+    }
+    huge_pages_ = true;
+    return true;
+#else
+    FLOGW("transparent huge pages are only supported on linux");
+    return false;
+#endif
+}
+
+size_t ImagePool::BufferSize(size_t size) {
+    auto class_size = ClassSize(size);
+    if (huge_pages_ && class_size >= kHugePageSize) {
+        class_size = (class_size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+    return class_size;
+}
+
+uint8_t* ImagePool::Map(size_t size) {
+    return huge_pages_ && size >= kHugePageSize ? MapHugeImage(size) : MapImage(size);
+}
+
+uint8_t* ImagePool::Acquire(size_t size) {
+    auto class_size = BufferSize(size);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = free_.find(class_size);
+        if (it != free_.end() && !it->second.empty()) {
+            auto data = it->second.back();
+            it->second.pop_back();
+            cached_ -= class_size;
+            hits_++;
+            return data;
+        }
+        misses_++;
+    }
+    return Map(class_size);
+}
+
+void ImagePool::Release(uint8_t* data, size_t size) {
+    if (data == nullptr) {
+        return;
+    }
+    auto class_size = BufferSize(size);
+    bool keep;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        keep = cached_ + class_size <= max_cached_;
+        if (keep) {
+            cached_ += class_size;
+        }
+    }
+    if (!keep) {
+        UnmapImage(data, class_size);
+        return;
+    }
+    // reset outside the lock, the buffer is published after that
+    ResetImage(data, class_size);
+    std::lock_guard<std::mutex> guard(lock_);
+    free_[class_size].push_back(data);
+}
+
+void ImagePool::Trim(size_t max_cached) {
+    std::vector<std::pair<uint8_t*, size_t>> dropped;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (auto it = free_.rbegin(); it != free_.rend() && cached_ > max_cached; ++it) {
+            while (!it->second.empty() && cached_ > max_cached) {
+                dropped.emplace_back(it->second.back(), it->first);
+                it->second.pop_back();
+                cached_ -= it->first;
+            }
+        }
+    }
+    for (auto& buffer : dropped) {
+        UnmapImage(buffer.first, buffer.second);
+    }
+}
+
+size_t ImagePool::hits() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return hits_;
+}
+
+size_t ImagePool::misses() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return misses_;
+}
+
+size_t ImagePool::cached() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return cached_;
+}
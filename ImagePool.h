@@ -0,0 +1,95 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Pool of large buffers for loaded and rebuilt images
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_IMAGEPOOL_H
+#define SOFIXER_IMAGEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Buffers are mapped in size classes, four between two powers of two, and
+// kept when released instead of unmapped.  A kept buffer is marked with
+// MADV_FREE(MADV_DONTNEED if not supported), the kernel takes its pages
+// only under memory pressure, so the next job of the same class usually
+// writes to pages already mapped.  Content of an acquired buffer is
+// undefined.  Shared by the jobs of batch and serve mode, a null pool
+// allocates from heap as usual.
+class ImagePool {
+public:
+    explicit ImagePool(size_t max_cached = (size_t)256 << 20);
+    ~ImagePool();
+    ImagePool(const ImagePool&) = delete;
+    ImagePool& operator=(const ImagePool&) = delete;
+
+    uint8_t* Acquire(size_t size);
+    // size is the one passed to Acquire
+    void Release(uint8_t* data, size_t size);
+
+    static uint8_t* Acquire(ImagePool* pool, size_t size) {
+        return pool != nullptr ? pool->Acquire(size) : new uint8_t[size];
+    }
+    static void Release(ImagePool* pool, uint8_t* data, size_t size) {
+        if (pool != nullptr) {
+            pool->Release(data, size);
+        } else {
+            delete[] data;
+        }
+    }
+
+    // Size of the buffer mapped for size.
+    static size_t ClassSize(size_t size);
+    // Size of the buffer taken from pool for size, with huge page alignment.
+    size_t BufferSize(size_t size);
+    static size_t BufferSize(ImagePool* pool, size_t size) {
+        return pool != nullptr ? pool->BufferSize(size) : size;
+    }
+
+    // Unmap kept buffers, the largest first, until at most max_cached bytes
+    // are kept.
+    void Trim(size_t max_cached);
+
+    // Buffers of 2MB or more are aligned to 2MB and backed by transparent
+    // huge pages(MADV_HUGEPAGE), so pointers spread over a large image take
+    // fewer TLB entries. Set before the first Acquire. Returns false, and
+    // buffers stay on normal pages, if huge pages are not available.
+    bool setHugePages(bool enable);
+
+    // buffers taken from pool or newly mapped, and bytes kept
+    size_t hits();
+    size_t misses();
+    size_t cached();
+
+private:
+    uint8_t* Map(size_t size);
+
+    bool huge_pages_ = false;
+    std::mutex lock_;
+    // kept buffers by class size
+    std::map<size_t, std::vector<uint8_t*>> free_;
+    size_t max_cached_;
+    size_t cached_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+// Gives an image back to the pool it is acquired from.
+struct ImageDeleter {
+    ImagePool* pool = nullptr;
+    size_t size = 0;
+
+    ImageDeleter() = default;
+    ImageDeleter(ImagePool* pool, size_t size) : pool(pool), size(size) {}
+    void operator()(uint8_t* data) const {
+        ImagePool::Release(pool, data, size);
+    }
+};
+
+typedef std::unique_ptr<uint8_t[], ImageDeleter> ImageBuffer;
+
+#endif //SOFIXER_IMAGEPOOL_H
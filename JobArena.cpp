@@ -0,0 +1,63 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "JobArena.h"
+#include <algorithm>
+
+JobArena::JobArena(size_t block_size) : block_size_(block_size == 0 ? 4096 : block_size) {
+}
+
+JobArena::~JobArena() {
+    for (auto& block : blocks_) {
+        ::operator delete(block.data);
+    }
+}
+
+void JobArena::AddBlock(size_t size) {
+    Block block;
+    block.data = static_cast<uint8_t*>(::operator new(size));
+    block.size = size;
+    blocks_.push_back(block);
+    cur_ = block.data;
+    end_ = block.data + size;
+    capacity_ += size;
+}
+
+void* JobArena::Allocate(size_t size, size_t align) {
+    auto aligned = [&]() {
+        return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(uintptr_t)(align - 1));
+    };
+    auto p = aligned();
+    if (cur_ == nullptr || p > end_ || (size_t)(end_ - p) < size) {
+        // the rest of the current block is left unused
+        AddBlock(std::max(block_size_, size + align));
+        p = aligned();
+    }
+    cur_ = p + size;
+    used_ += size;
+    return p;
+}
+
+void JobArena::Free(void* p, size_t size) {
+    if (p != nullptr && static_cast<uint8_t*>(p) + size == cur_) {
+        cur_ = static_cast<uint8_t*>(p);
+        used_ -= size;
+    }
+}
+
+void JobArena::Reset() {
+    if (blocks_.size() > 1) {
+        auto total = capacity_;
+        for (auto& block : blocks_) {
+            ::operator delete(block.data);
+        }
+        blocks_.clear();
+        capacity_ = 0;
+        AddBlock(total);
+    } else if (!blocks_.empty()) {
+        cur_ = blocks_[0].data;
+    }
+    used_ = 0;
+}
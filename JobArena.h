@@ -0,0 +1,118 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Bump allocator for the metadata of a fix job
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_JOBARENA_H
+#define SOFIXER_JOBARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Small objects of a job(phdr table, shdrs, shstrtab, file reader ...) are
+// taken from blocks owned by the arena and released at once by Reset.  An
+// arena is used by one thread, workers keep their own and reset it between
+// jobs, so the blocks are reused instead of going through the allocator
+// shared by all workers.  Everything also works with a null arena, which
+// allocates from heap as usual.
+class JobArena {
+public:
+    explicit JobArena(size_t block_size = 64 << 10);
+    ~JobArena();
+    JobArena(const JobArena&) = delete;
+    JobArena& operator=(const JobArena&) = delete;
+
+    void* Allocate(size_t size, size_t align);
+    // Only the last allocation is given back, the rest waits for Reset.
+    void Free(void* p, size_t size);
+    // Release everything allocated. Blocks are kept, merged into one if the
+    // job needed more than one, so the next job of the same size fits.
+    void Reset();
+
+    // bytes allocated since Reset, and bytes of blocks held
+    size_t used() const { return used_; }
+    size_t capacity() const { return capacity_; }
+
+    static void* Allocate(JobArena* arena, size_t size, size_t align) {
+        return arena != nullptr ? arena->Allocate(size, align) : ::operator new(size);
+    }
+    static void Free(JobArena* arena, void* p, size_t size) {
+        if (arena != nullptr) {
+            arena->Free(p, size);
+        } else {
+            ::operator delete(p);
+        }
+    }
+    template <typename T, typename... Args>
+    static T* New(JobArena* arena, Args&&... args) {
+        return new(Allocate(arena, sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    template <typename T>
+    static void Delete(JobArena* arena, T* p) {
+        if (p != nullptr) {
+            p->~T();
+            Free(arena, p, sizeof(T));
+        }
+    }
+
+private:
+    struct Block {
+        uint8_t* data;
+        size_t size;
+    };
+    void AddBlock(size_t size);
+
+    size_t block_size_;
+    std::vector<Block> blocks_;
+    uint8_t* cur_ = nullptr;
+    uint8_t* end_ = nullptr;
+    size_t used_ = 0;
+    size_t capacity_ = 0;
+};
+
+// Allocator of standard containers backed by an arena, or heap if null.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    // containers assigned to take the arena of the other one
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(JobArena* arena = nullptr) : arena_(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(JobArena::Allocate(arena_, n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        JobArena::Free(arena_, p, n * sizeof(T));
+    }
+    JobArena* arena() const { return arena_; }
+
+private:
+    JobArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& first, const ArenaAllocator<U>& second) {
+    return first.arena() == second.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& first, const ArenaAllocator<U>& second) {
+    return first.arena() != second.arena();
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+#endif //SOFIXER_JOBARENA_H
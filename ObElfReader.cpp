@@ -8,11 +8,14 @@
 
 #include <vector>
 #include <algorithm>
+#include <climits>
 
 void ObElfReader::FixDumpSoPhdr() {
+    PhaseTimer timer(stats_, "fix_dump_phdr");
     // some shell will release data between loadable phdr(s), just load all memory data
     if (dump_so_base_ != 0) {
-        std::vector<Elf_Phdr*> loaded_phdrs;
+        ArenaVector<Elf_Phdr*> loaded_phdrs(arena_);
+        loaded_phdrs.reserve(phdr_num_);
         for (auto i = 0; i < phdr_num_; i++) {
             auto phdr = &phdr_table_[i];
             if(phdr->p_type != PT_LOAD) continue;
@@ -48,7 +51,12 @@ void ObElfReader::FixDumpSoPhdr() {
     }
 }
 
+ObElfReader::~ObElfReader() {
+    TrackAlloc(stats_, "base_dynamic", -(int64_t)(dynamic_count_ * sizeof(Elf_Dyn)));
+}
+
 bool ObElfReader::Load() {
+    PhaseTimer timer(stats_, "load");
     // try open
     if (!ReadElfHeader() || !VerifyElfHeader() || !ReadProgramHeader())
         return false;
@@ -84,6 +92,57 @@ bool ObElfReader::Load() {
     return true;
 }
 
+size_t ObElfReader::EstimateMemory() {
+    if (!ReadElfHeader() || !VerifyElfHeader() || !ReadProgramHeader())
+        return 0;
+    FixDumpSoPhdr();
+
+    size_t pad_size = 0;
+    if (!haveDynamicSectionInLoadableSegment() && LoadDynamicSectionFromBaseSource()) {
+        pad_size = dynamic_count_ * sizeof(Elf_Dyn);
+    }
+    auto load_size = phdr_table_get_load_size(phdr_table_, phdr_num_);
+    // loaded image, rebuilt output of the same size with shdrs and shstrtab,
+    // both rounded up to the buffers of image pool
+    return ImagePool::BufferSize(image_pool_, load_size + pad_size) +
+           ImagePool::BufferSize(image_pool_, load_size + pad_size + PAGE_SIZE);
+}
+
+size_t ObElfReader::EstimateRelocations() {
+    auto dynamic = reinterpret_cast<const Elf_Dyn*>(dynamic_sections_);
+    auto dynamic_count = dynamic_count_;
+    std::vector<Elf_Dyn> buffer;
+    if (dynamic == nullptr) {
+        // p_offset is p_vaddr after FixDumpSoPhdr
+        for (size_t i = 0; i < phdr_num_; i++) {
+            auto phdr = &phdr_table_[i];
+            if (phdr->p_type != PT_DYNAMIC || phdr->p_offset > INT_MAX) continue;
+            buffer.resize(phdr->p_filesz / sizeof(Elf_Dyn));
+            auto size = buffer.size() * sizeof(Elf_Dyn);
+            if (size == 0 || source_->Read(buffer.data(), size, phdr->p_offset) != size) {
+                return 0;
+            }
+            break;
+        }
+        dynamic = buffer.data();
+        dynamic_count = buffer.size();
+    }
+
+    size_t rel_size = 0, rela_size = 0, plt_size = 0;
+    Elf_Addr plt_type = DT_REL;
+    for (size_t i = 0; i < dynamic_count && dynamic[i].d_tag != DT_NULL; i++) {
+        switch (dynamic[i].d_tag) {
+            case DT_RELSZ: rel_size = dynamic[i].d_un.d_val; break;
+            case DT_RELASZ: rela_size = dynamic[i].d_un.d_val; break;
+            case DT_PLTRELSZ: plt_size = dynamic[i].d_un.d_val; break;
+            case DT_PLTREL: plt_type = dynamic[i].d_un.d_val; break;
+            default: break;
+        }
+    }
+    return rel_size / sizeof(Elf_Rel) + rela_size / sizeof(Elf_Rela) +
+           plt_size / (plt_type == DT_RELA ? sizeof(Elf_Rela) : sizeof(Elf_Rel));
+}
+
 //void ObElfReader::GetDynamicSection(Elf_Dyn **dynamic, size_t *dynamic_count, Elf_Word *dynamic_flags) {
 //    if (dynamic_sections_ == nullptr) {
 //        ElfReader::GetDynamicSection(dynamic, dynamic_count, dynamic_flags);
@@ -99,47 +158,34 @@ bool ObElfReader::Load() {
 //    return;
 //}
 
-ObElfReader::~ObElfReader() {
-    if (dynamic_sections_ != nullptr) {
-        delete [](uint8_t*)dynamic_sections_;
-    }
-}
-
 bool ObElfReader::LoadDynamicSectionFromBaseSource() {
+    PhaseTimer timer(stats_, "load_base_dynamic");
     if (baseso_ == nullptr) {
         return false;
     }
-    ElfReader base_reader;
 
     // if base so is provided, load dynamic section from base so
-    if (!base_reader.setSource(baseso_) ||
-        !base_reader.ReadElfHeader() ||
-        !base_reader.VerifyElfHeader() ||
-        !base_reader.ReadProgramHeader()) {
+    baseso_info_ = baseso_cache_ != nullptr ? baseso_cache_->Get(baseso_) :
+                   BaseSoInfo::Parse(baseso_);
+    if (baseso_info_ == nullptr) {
         FLOGE("Unable to parse base so file, is it correct?");
         return false;
     }
-    const Elf_Phdr * phdr_table_ = base_reader.phdr_table_;
-    const Elf_Phdr * phdr_limit = phdr_table_ + base_reader.phdr_num_;
-    const Elf_Phdr * phdr;
-
-    for (phdr = phdr_table_; phdr < phdr_limit; phdr++) {
-        if (phdr->p_type != PT_DYNAMIC) {
-            continue;
-        }
-
-        dynamic_sections_ = new uint8_t [phdr->p_memsz];
-        base_reader.source_->Read(dynamic_sections_, phdr->p_memsz, phdr->p_offset);
-
-        dynamic_count_ = (unsigned)(phdr->p_memsz / sizeof(Elf_Dyn));
-        dynamic_flags_ = phdr->p_flags;
-        return true;
+    if (baseso_info_->dynamic.empty()) {
+        return false;
     }
 
-    return false;
+    // shared with other jobs by base so cache, but held while the job runs
+    TrackAlloc(stats_, "base_dynamic",
+               ((int64_t)baseso_info_->dynamic.size() - (int64_t)dynamic_count_) * sizeof(Elf_Dyn));
+    dynamic_sections_ = baseso_info_->dynamic.data();
+    dynamic_count_ = baseso_info_->dynamic.size();
+    dynamic_flags_ = baseso_info_->dynamic_flags;
+    return true;
 }
 
 void ObElfReader::ApplyDynamicSection() {
+    PhaseTimer timer(stats_, "apply_base_dynamic");
     if (dynamic_sections_ == nullptr)
         return;
     uint8_t * wbuf_start = load_start_ + load_size_;
@@ -8,6 +8,7 @@
 #define SOFIXER_OBELFREADER_H
 
 #include "ElfReader.h"
+#include "BaseSoCache.h"
 class ElfRebuilder;
 
 class ObElfReader: public ElfReader {
@@ -18,6 +19,12 @@ public:
     void FixDumpSoPhdr();
 
     bool Load() override;
+    // Estimate memory used to fix the file without loading it, only elf header
+    // and phdr table are read. Returns 0 for invalid file.
+    size_t EstimateMemory();
+    // Relocation count given by the dynamic section(DT_RELSZ, DT_RELASZ,
+    // DT_PLTRELSZ), call after EstimateMemory.
+    size_t EstimateRelocations();
     bool LoadDynamicSectionFromBaseSource();
 
     void setDumpSoBaseAddr(Elf_Addr base) { dump_so_base_ = base; }
@@ -25,6 +32,8 @@ public:
     void setBaseSoName(const char* name) {
         baseso_ = name;
     }
+    // parsed base so is taken from cache if set
+    void setBaseSoCache(BaseSoCache* cache) { baseso_cache_ = cache; }
 
 //    void GetDynamicSection(Elf_Dyn** dynamic, size_t* dynamic_count, Elf_Word* dynamic_flags) override;
     bool haveDynamicSectionInLoadableSegment();
@@ -35,8 +44,11 @@ private:
     Elf_Addr dump_so_base_ = 0;
 
     const char* baseso_ = nullptr;
+    BaseSoCache* baseso_cache_ = nullptr;
+    std::shared_ptr<const BaseSoInfo> baseso_info_;
 
-    void* dynamic_sections_ = nullptr;
+    // point to dynamic data of baseso_info_
+    const void* dynamic_sections_ = nullptr;
     size_t dynamic_count_ = 0;
     Elf_Word dynamic_flags_ = 0;
 
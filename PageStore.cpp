@@ -0,0 +1,185 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "PageStore.h"
+#include "Hash.h"
+#include "FileUtil.h"
+#include "FDebug.h"
+#include "macros.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+
+#define MANIFEST_MAGIC "sofixer-pages"
+// Smaller outputs are hashed in the calling thread.
+#define PAGES_PER_WORKER 64
+
+PageStore::PageStore(const std::string &dir, unsigned hash_workers)
+        : dir_(dir), hash_workers_(hash_workers) {
+    if (hash_workers_ == 0) {
+        hash_workers_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool PageStore::Init() {
+    if (!MakeDir(dir_) || !MakeDir(dir_ + "/pages") || !MakeDir(dir_ + "/manifests")) {
+        FLOGE("unable to create page store %s: %s", dir_.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+std::string PageStore::PagePath(const std::string& id, bool create_dir) {
+    auto sub_dir = dir_ + "/pages/" + id.substr(0, 2);
+    if (create_dir) {
+        MakeDir(sub_dir);
+    }
+    return sub_dir + "/" + id;
+}
+
+// '/' and '%' of name are escaped, so outputs of the same file name in
+// different directories get their own manifest.
+std::string PageStore::ManifestPath(const std::string &name) {
+    std::string escaped;
+    for (auto c : name) {
+        if (c == '/' || c == '\\' || c == '%') {
+            char buf[4];
+            snprintf(buf, sizeof(buf), "%%%02X", (unsigned char)c);
+            escaped += buf;
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    return dir_ + "/manifests/" + escaped;
+}
+
+// Returns true if the file at path holds exactly page.
+static bool SamePage(const std::string& path, const uint8_t* page, size_t len) {
+    auto fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> stored(len + 1);
+    auto n = fread(stored.data(), 1, stored.size(), fp);
+    fclose(fp);
+    return n == len && memcmp(stored.data(), page, len) == 0;
+}
+
+// Store page under its hash, or the next free <hash>-<n> if a different
+// page of the same hash is stored already.
+bool PageStore::StorePage(const uint8_t* page, size_t len, std::string* id, size_t* stored) {
+    auto hash = HashToString(HashData(page, len));
+    for (unsigned n = 0;; n++) {
+        *id = n == 0 ? hash : hash + "-" + std::to_string(n);
+        auto path = PagePath(*id, true);
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            if (!WriteFileAtomic(path, page, len, true)) {
+                FLOGE("unable to write page %s", path.c_str());
+                return false;
+            }
+            (*stored)++;
+            return true;
+        }
+        if (SamePage(path, page, len)) {
+            return true;
+        }
+        FLOGW("page hash %s collides, try the next slot", id->c_str());
+    }
+}
+
+bool PageStore::StorePages(const uint8_t *data, size_t size, size_t begin, size_t end,
+                           std::string *ids, size_t *stored) {
+    for (auto i = begin; i < end; i++) {
+        auto offset = i * PAGE_SIZE;
+        auto len = std::min<size_t>(PAGE_SIZE, size - offset);
+        if (!StorePage(data + offset, len, &ids[i], stored)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PageStore::Put(const std::string &name, const void *data, size_t size) {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    auto page_count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    std::vector<std::string> ids(page_count);
+
+    auto workers = std::min<size_t>(hash_workers_, page_count / PAGES_PER_WORKER);
+    bool ok = true;
+    size_t stored = 0;
+    if (workers <= 1) {
+        ok = StorePages(bytes, size, 0, page_count, ids.data(), &stored);
+    } else {
+        std::vector<std::thread> threads;
+        std::vector<size_t> worker_stored(workers);
+        std::vector<char> worker_ok(workers);
+        auto step = (page_count + workers - 1) / workers;
+        for (size_t i = 0; i < workers; i++) {
+            auto begin = std::min(page_count, i * step);
+            auto end = std::min(page_count, begin + step);
+            threads.emplace_back([&, i, begin, end]() {
+                worker_ok[i] = StorePages(bytes, size, begin, end, ids.data(), &worker_stored[i]);
+            });
+        }
+        for (size_t i = 0; i < workers; i++) {
+            threads[i].join();
+            ok = ok && worker_ok[i];
+            stored += worker_stored[i];
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+
+    std::ostringstream manifest;
+    manifest << MANIFEST_MAGIC << " " << PAGE_SIZE << " " << size << "\n";
+    for (auto& id : ids) {
+        manifest << id << "\n";
+    }
+    auto text = manifest.str();
+    if (!WriteFileAtomic(ManifestPath(name), text.data(), text.size())) {
+        FLOGE("unable to write manifest of %s", name.c_str());
+        return false;
+    }
+    FLOGI("%s is stored with %zu new pages of %zu", name.c_str(), stored, page_count);
+    return true;
+}
+
+bool PageStore::Get(const std::string &name, std::vector<uint8_t> *data) {
+    std::ifstream manifest(ManifestPath(name));
+    std::string magic;
+    size_t page_size = 0, size = 0;
+    if (!(manifest >> magic >> page_size >> size) || magic != MANIFEST_MAGIC || page_size == 0) {
+        FLOGE("%s is not in page store", name.c_str());
+        return false;
+    }
+
+    data->resize(size);
+    std::string id;
+    size_t offset = 0;
+    while (offset < size && manifest >> id) {
+        auto len = std::min(page_size, size - offset);
+        auto path = PagePath(id, false);
+        auto fp = fopen(path.c_str(), "rb");
+        auto ok = fp != nullptr && fread(data->data() + offset, 1, len, fp) == len;
+        if (fp != nullptr) fclose(fp);
+        if (!ok) {
+            FLOGE("page %s of %s is missing", id.c_str(), name.c_str());
+            return false;
+        }
+        offset += len;
+    }
+    if (offset != size) {
+        FLOGE("manifest of %s is truncated", name.c_str());
+        return false;
+    }
+    return true;
+}
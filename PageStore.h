@@ -0,0 +1,44 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Fixed outputs stored as deduplicated pages
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_PAGESTORE_H
+#define SOFIXER_PAGESTORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Outputs of the same library dumped from different devices differ in a few
+// pages only. Every unique page is kept once in dir/pages/<2 hex>/<16 hex>, a
+// manifest in dir/manifests/<name> lists the pages of one output. Pages of the
+// same hash but different content are kept as <16 hex>-<n>.
+class PageStore {
+public:
+    // hash_workers: threads hashing pages of one output, 0 for cpu count
+    explicit PageStore(const std::string& dir, unsigned hash_workers = 0);
+
+    bool Init();
+
+    // Store data as name, replacing the previous manifest of name. Name is
+    // usually the output path, '/' is allowed.
+    bool Put(const std::string& name, const void* data, size_t size);
+    // Reassemble the output stored as name.
+    bool Get(const std::string& name, std::vector<uint8_t>* data);
+
+private:
+    std::string PagePath(const std::string& id, bool create_dir);
+    std::string ManifestPath(const std::string& name);
+    // Hash pages [begin, end) of data, write the new ones and set their ids.
+    bool StorePages(const uint8_t* data, size_t size, size_t begin, size_t end,
+                    std::string* ids, size_t* stored);
+    bool StorePage(const uint8_t* page, size_t len, std::string* id, size_t* stored);
+
+    std::string dir_;
+    unsigned hash_workers_;
+};
+
+
+#endif //SOFIXER_PAGESTORE_H
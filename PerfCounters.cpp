@@ -0,0 +1,151 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "PerfCounters.h"
+#include "FDebug.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* perf_counter_names[PERF_COUNTER_COUNT] = {
+        "cycles", "instructions", "llc_misses", "page_faults", "dtlb_misses"
+};
+
+static std::atomic<bool> perf_enabled(false);
+
+const char* PerfCounterName(int counter) {
+    return counter >= 0 && counter < PERF_COUNTER_COUNT ? perf_counter_names[counter] : "unknown";
+}
+
+#ifdef __linux__
+
+static int OpenCounter(int counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (counter) {
+        case PERF_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_LLC_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PERF_PAGE_FAULTS:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        case PERF_DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default:
+            return -1;
+    }
+    // user space only, which is allowed with the default perf_event_paranoid
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+namespace {
+// Counters follow the thread they are opened on, so every thread opens its
+// own when it first reads them.
+class ThreadCounters {
+public:
+    ~ThreadCounters() {
+        for (auto fd : fds_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    // Returns the count of counters opened.
+    int Open() {
+        int opened = 0;
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            fds_[i] = OpenCounter(i);
+            opened += fds_[i] >= 0;
+        }
+        opened_ = true;
+        return opened;
+    }
+
+    void Read(int64_t values[PERF_COUNTER_COUNT]) {
+        if (!opened_) {
+            Open();
+        }
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            uint64_t value;
+            values[i] = fds_[i] >= 0 && read(fds_[i], &value, sizeof(value)) == sizeof(value) ?
+                        (int64_t)value : -1;
+        }
+    }
+
+private:
+    bool opened_ = false;
+    int fds_[PERF_COUNTER_COUNT] = {-1, -1, -1, -1, -1};
+};
+}
+
+static thread_local ThreadCounters thread_counters;
+
+bool EnablePerfCounters() {
+    int64_t values[PERF_COUNTER_COUNT];
+    perf_enabled = true;
+    ReadPerfCounters(values);
+    int available = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (values[i] >= 0) {
+            available++;
+        } else {
+            FLOGD("%s counter is not available", PerfCounterName(i));
+        }
+    }
+    if (available == 0) {
+        FLOGW("performance counters are not available: %s", strerror(errno));
+        perf_enabled = false;
+        return false;
+    }
+    return true;
+}
+
+bool ReadPerfCounters(int64_t values[PERF_COUNTER_COUNT]) {
+    if (!perf_enabled.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    thread_counters.Read(values);
+    return true;
+}
+
+#else
+
+bool EnablePerfCounters() {
+    FLOGW("performance counters are only supported on linux");
+    return false;
+}
+
+bool ReadPerfCounters(int64_t values[PERF_COUNTER_COUNT]) {
+    return false;
+}
+
+#endif
+
+bool PerfCountersEnabled() {
+    return perf_enabled.load(std::memory_order_relaxed);
+}
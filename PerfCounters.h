@@ -0,0 +1,33 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Hardware performance counters of phases with perf_event_open
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_PERFCOUNTERS_H
+#define SOFIXER_PERFCOUNTERS_H
+
+#include <cstdint>
+
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_DTLB_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+// Name used in stats json.
+const char* PerfCounterName(int counter);
+
+// Count user space events of every thread from now on. Returns false, and
+// nothing is counted, if no counter can be opened(not linux, no permission,
+// no pmu in virtual machine ...).  Counters missing alone are left out.
+bool EnablePerfCounters();
+bool PerfCountersEnabled();
+
+// Current values for the calling thread, -1 for counters not available.
+// Returns false if counters are not enabled.
+bool ReadPerfCounters(int64_t values[PERF_COUNTER_COUNT]);
+
+#endif //SOFIXER_PERFCOUNTERS_H
@@ -0,0 +1,154 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "Refix.h"
+#include "ElfRebuilder.h"
+#include "FileUtil.h"
+#include "Hash.h"
+#include "FDebug.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#define REFIX_MAGIC "sofixer-refix"
+
+bool RefixMeta::Save(const std::string &path) const {
+    std::ostringstream out;
+    out << std::hex;
+    out << REFIX_MAGIC << " " << PAGE_SIZE << "\n";
+    out << "options " << options << "\n";
+    out << "source " << source_size << "\n";
+    out << "dump_base " << dump_base << "\n";
+    out << "load_size " << load_size << "\n";
+    out << "symtab " << symtab << "\n";
+    out << "output " << output_hash << "\n";
+    for (auto& load : loads) {
+        out << "load " << load.vaddr << " " << load.size << "\n";
+    }
+    for (auto& chunk : chunks) {
+        out << "chunk " << chunk.vaddr << " " << chunk.size << " " << chunk.offset << "\n";
+    }
+    for (auto& range : fixed) {
+        out << "fixed " << range.vaddr << " " << range.size << "\n";
+    }
+    for (auto& table : tables) {
+        out << "rel " << table.rela << " " << table.vaddr << " " << table.count << "\n";
+    }
+    for (auto page : pages) {
+        out << "page " << page << "\n";
+    }
+    auto text = out.str();
+    return WriteFileAtomic(path, text.data(), text.size());
+}
+
+bool RefixMeta::Load(const std::string &path) {
+    std::ifstream in(path);
+    std::string magic;
+    size_t page_size = 0;
+    if (!(in >> magic >> std::hex >> page_size) || magic != REFIX_MAGIC || page_size != PAGE_SIZE) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) continue;
+        fields >> std::hex;
+        if (key == "options") {
+            fields >> options;
+        } else if (key == "source") {
+            fields >> source_size;
+        } else if (key == "dump_base") {
+            fields >> dump_base;
+        } else if (key == "load_size") {
+            fields >> load_size;
+        } else if (key == "symtab") {
+            fields >> symtab;
+        } else if (key == "output") {
+            fields >> output_hash;
+        } else if (key == "load") {
+            Range range = {0, 0};
+            fields >> range.vaddr >> range.size;
+            loads.push_back(range);
+        } else if (key == "chunk") {
+            Chunk chunk = {0, 0, 0};
+            fields >> chunk.vaddr >> chunk.size >> chunk.offset;
+            chunks.push_back(chunk);
+        } else if (key == "fixed") {
+            Range range = {0, 0};
+            fields >> range.vaddr >> range.size;
+            fixed.push_back(range);
+        } else if (key == "rel") {
+            RelTable table = {false, 0, 0};
+            fields >> table.rela >> table.vaddr >> table.count;
+            tables.push_back(table);
+        } else if (key == "page") {
+            uint64_t page = 0;
+            fields >> page;
+            pages.push_back(page);
+        }
+        if (fields.fail()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<uint64_t> HashDumpPages(const uint8_t *dump, size_t size) {
+    std::vector<uint64_t> pages((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    for (size_t i = 0; i < pages.size(); i++) {
+        auto offset = i * PAGE_SIZE;
+        pages[i] = HashData(dump + offset, std::min<size_t>(PAGE_SIZE, size - offset));
+    }
+    return pages;
+}
+
+bool RefixOutput(const RefixMeta &previous, const RefixMeta &current,
+                 const uint8_t *dump, std::vector<uint8_t> *output) {
+    if (previous.options != current.options) {
+        FLOGI("options or base so changed since previous output, rebuild all");
+        return false;
+    }
+    if (previous.source_size != current.source_size || previous.pages.size() != current.pages.size()) {
+        FLOGI("dump size changed since previous output, rebuild all");
+        return false;
+    }
+    // edited, replaced or fixed again without refix data since then
+    if (previous.output_hash != HashData(output->data(), output->size())) {
+        FLOGI("previous output changed since its refix data was saved, rebuild all");
+        return false;
+    }
+    for (auto& chunk : previous.chunks) {
+        if (chunk.offset + chunk.size > output->size()) {
+            FLOGE("previous output does not match its refix data");
+            return false;
+        }
+    }
+
+    std::vector<bool> changed(current.pages.size());
+    size_t changed_count = 0;
+    for (size_t i = 0; i < changed.size(); i++) {
+        if (previous.pages[i] == current.pages[i]) continue;
+        Elf_Addr start = i * PAGE_SIZE;
+        Elf_Addr end = start + PAGE_SIZE;
+        for (auto& range : previous.fixed) {
+            if (range.vaddr < end && range.vaddr + range.size > start) {
+                FLOGI("page %zx holds elf information and has changed, rebuild all", (size_t)start);
+                return false;
+            }
+        }
+        changed[i] = true;
+        changed_count++;
+    }
+
+    if (changed_count != 0) {
+        ElfRebuilder elf_rebuilder(nullptr);
+        if (!elf_rebuilder.RebuildPatch(previous, dump, changed, output->data(), output->size())) {
+            return false;
+        }
+    }
+    FLOGI("%zu of %zu pages changed, refixed from previous output", changed_count, changed.size());
+    return true;
+}
@@ -0,0 +1,70 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Incremental re-fix of a new dump against a previous output of the same
+// library
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_REFIX_H
+#define SOFIXER_REFIX_H
+
+#include "macros.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define REFIX_SUFFIX ".refix"
+
+// Saved next to a fixed output(output.refix). It records how the output was
+// built from the dump, so that a dump differing in a few pages can be fixed
+// by patching those pages into the output.
+struct RefixMeta {
+    struct Range {
+        Elf_Addr vaddr;
+        Elf_Addr size;
+    };
+    struct Chunk {
+        Elf_Addr vaddr;
+        Elf_Addr size;
+        Elf_Addr offset;
+    };
+    struct RelTable {
+        bool rela;
+        Elf_Addr vaddr;
+        Elf_Addr count;
+    };
+
+    // hash of the options and base so that change the output
+    uint64_t options = 0;
+    Elf_Addr source_size = 0;
+    Elf_Addr dump_base = 0;
+    Elf_Addr load_size = 0;
+    Elf_Addr symtab = 0;
+    // hash of the output file, it is only patched if unchanged since saved
+    uint64_t output_hash = 0;
+    // dump data loaded into image
+    std::vector<Range> loads;
+    // image data written to output file
+    std::vector<Chunk> chunks;
+    // dump data the layout and sections are built from(headers, .dynamic,
+    // .dynsym, relocations, end of segment data), a change in them needs a
+    // full rebuild
+    std::vector<Range> fixed;
+    // relocation tables in the order they are applied
+    std::vector<RelTable> tables;
+    // hash of every dump page
+    std::vector<uint64_t> pages;
+
+    bool Save(const std::string& path) const;
+    bool Load(const std::string& path);
+};
+
+// Hash every page of the dump.
+std::vector<uint64_t> HashDumpPages(const uint8_t* dump, size_t size);
+
+// Patch dump into output, a previous output described by previous. current
+// holds the options, source size and page hashes of dump. Returns false if
+// the output needs a full rebuild.
+bool RefixOutput(const RefixMeta& previous, const RefixMeta& current,
+                 const uint8_t* dump, std::vector<uint8_t>* output);
+
+#endif //SOFIXER_REFIX_H
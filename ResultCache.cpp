@@ -0,0 +1,179 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "ResultCache.h"
+#include "Hash.h"
+#include "FileUtil.h"
+#include "FDebug.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define SOFIXER_HAVE_LINK 1
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+ResultCache::ResultCache(const std::string &dir) : dir_(dir) {
+}
+
+bool ResultCache::Init() {
+    if (!MakeDir(dir_)) {
+        FLOGE("unable to create cache directory %s: %s", dir_.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+std::string ResultCache::EntryPath(uint64_t key, unsigned n, bool create_dir) {
+    auto name = HashToString(key);
+    auto sub_dir = dir_ + "/" + name.substr(0, 2);
+    if (create_dir) {
+        MakeDir(sub_dir);
+    }
+    return sub_dir + "/" + name + (n == 0 ? "" : "-" + std::to_string(n));
+}
+
+static std::string CheckText(const ResultCheck& check) {
+    return HashToString(check.source_size) + " " + HashToString(check.source_hash) + " " +
+           HashToString(check.options) + "\n";
+}
+
+// The check is written before the entry, so an entry always has its check.
+static bool SameCheck(const std::string& entry, const ResultCheck& check) {
+    auto expected = CheckText(check);
+    auto fp = fopen((entry + ".check").c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    std::vector<char> stored(expected.size() + 1);
+    auto n = fread(stored.data(), 1, stored.size(), fp);
+    fclose(fp);
+    return n == expected.size() && memcmp(stored.data(), expected.data(), n) == 0;
+}
+
+std::string ResultCache::FindEntry(uint64_t key, const ResultCheck &check, bool for_store) {
+    for (unsigned n = 0;; n++) {
+        auto entry = EntryPath(key, n, for_store);
+        struct stat st;
+        if (stat(entry.c_str(), &st) != 0) {
+            return for_store ? entry : std::string();
+        }
+        if (SameCheck(entry, check)) {
+            return entry;
+        }
+        FLOGW("result cache key %s collides, try the next entry", HashToString(key).c_str());
+    }
+}
+
+// Copy file content at path to fd.
+static bool CopyToFd(FILE* src, int fd) {
+#ifdef SOFIXER_HAVE_LINK
+    char buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), src)) != 0) {
+        auto p = buf;
+        while (n != 0) {
+            auto w = TEMP_FAILURE_RETRY(write(fd, p, n));
+            if (w <= 0) return false;
+            p += w;
+            n -= w;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Reflink or hardlink entry to path, so that no data is copied.
+static bool LinkEntry(const std::string& entry, const std::string& path) {
+#ifdef SOFIXER_HAVE_LINK
+    unlink(path.c_str());
+#ifdef FICLONE
+    auto src = open(entry.c_str(), O_RDONLY);
+    if (src >= 0) {
+        auto dst = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        auto cloned = dst >= 0 && ioctl(dst, FICLONE, src) == 0;
+        if (dst >= 0) close(dst);
+        close(src);
+        if (cloned) return true;
+        unlink(path.c_str());
+    }
+#endif
+    return link(entry.c_str(), path.c_str()) == 0;
+#else
+    return false;
+#endif
+}
+
+bool ResultCache::Fetch(uint64_t key, const ResultCheck &check, const std::string &path, int fd,
+                        size_t *size) {
+    auto entry = FindEntry(key, check, false);
+    struct stat st;
+    if (entry.empty() || stat(entry.c_str(), &st) != 0) {
+        return false;
+    }
+    *size = st.st_size;
+    if (fd < 0 && !path.empty() && LinkEntry(entry, path)) {
+        return true;
+    }
+
+    auto src = fopen(entry.c_str(), "rb");
+    if (src == nullptr) {
+        return false;
+    }
+    bool ok;
+    if (fd >= 0) {
+        ok = CopyToFd(src, fd);
+    } else {
+        ok = true;
+        if (!path.empty()) {
+            auto dst = fopen(path.c_str(), "wb+");
+            ok = dst != nullptr;
+            char buf[64 * 1024];
+            size_t n;
+            while (ok && (n = fread(buf, 1, sizeof(buf), src)) != 0) {
+                ok = fwrite(buf, 1, n, dst) == n;
+            }
+            if (dst != nullptr) fclose(dst);
+        }
+    }
+    fclose(src);
+    return ok;
+}
+
+bool ResultCache::Load(uint64_t key, const ResultCheck &check, std::vector<uint8_t> *data) {
+    auto entry = FindEntry(key, check, false);
+    auto fp = entry.empty() ? nullptr : fopen(entry.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    data->resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    auto ok = fread(data->data(), 1, data->size(), fp) == data->size();
+    fclose(fp);
+    return ok;
+}
+
+bool ResultCache::Store(uint64_t key, const ResultCheck &check, const void *data, size_t size) {
+    auto entry = FindEntry(key, check, true);
+    auto text = CheckText(check);
+    // outputs may be hardlinks of the entry, keep it from being modified
+    if (!WriteFileAtomic(entry + ".check", text.data(), text.size(), true) ||
+        !WriteFileAtomic(entry, data, size, true)) {
+        FLOGE("unable to write cache file %s", entry.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Fixed outputs stored by the hash of their input and options
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_RESULTCACHE_H
+#define SOFIXER_RESULTCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The source an output is fixed from, stored with the output and compared
+// on lookup, so that sources of the same key never share an output.
+struct ResultCheck {
+    uint64_t source_size;
+    // hash of the source independent of the key
+    uint64_t source_hash;
+    // hash of the options and base so the output is fixed with
+    uint64_t options;
+};
+
+class ResultCache {
+public:
+    // Cached outputs are stored in dir/<2 hex>/<16 hex>, and the check of
+    // their source in <16 hex>.check. Outputs of different sources with the
+    // same key go to <16 hex>-<n>.
+    explicit ResultCache(const std::string& dir);
+
+    bool Init();
+
+    // Put the cached output of key and check at path(reflink, hardlink or
+    // copy), or write it to fd if fd >= 0. Returns false if it is not cached.
+    bool Fetch(uint64_t key, const ResultCheck& check, const std::string& path, int fd, size_t* size);
+    // Read the cached output of key and check into data.
+    bool Load(uint64_t key, const ResultCheck& check, std::vector<uint8_t>* data);
+    bool Store(uint64_t key, const ResultCheck& check, const void* data, size_t size);
+
+private:
+    std::string EntryPath(uint64_t key, unsigned n, bool create_dir);
+    // Entry of key stored for check, empty if there is none. With for_store
+    // the first free entry is returned instead if none is stored.
+    std::string FindEntry(uint64_t key, const ResultCheck& check, bool for_store);
+
+    std::string dir_;
+};
+
+
+#endif //SOFIXER_RESULTCACHE_H
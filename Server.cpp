@@ -0,0 +1,398 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "Server.h"
+#include "FDebug.h"
+#include "Trace.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#define SOFIXER_HAVE_UNIX_SOCKET 1
+#endif
+
+FixServer::FixServer(const FixOptions &defaults, unsigned worker_count)
+        : defaults_(defaults) {
+    defaults_.baseso_cache = &baseso_cache_;
+    defaults_.image_pool = &image_pool_;
+    image_pool_.setHugePages(defaults_.huge_pages);
+    if (worker_count == 0) {
+        worker_count = std::thread::hardware_concurrency();
+    }
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+    for (unsigned i = 0; i < worker_count; i++) {
+        workers_.emplace_back(&FixServer::WorkerLoop, this);
+    }
+}
+
+FixServer::~FixServer() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopped_ = true;
+    }
+    ready_.notify_all();
+    for (auto& t : workers_) {
+        t.join();
+    }
+    for (auto conn : connections_) {
+        CloseConnection(conn);
+    }
+    for (auto conn : returned_) {
+        CloseConnection(conn);
+    }
+#ifdef SOFIXER_HAVE_UNIX_SOCKET
+    for (auto fd : wake_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+void FixServer::WorkerLoop() {
+    static std::atomic<unsigned> next_worker(0);
+    TraceThreadName("worker " + std::to_string(next_worker++));
+    JobArena arena;
+    while (true) {
+        Connection* conn;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            while (connections_.empty() && !stopped_) {
+                ready_.wait(guard);
+            }
+            if (connections_.empty()) {
+                return;
+            }
+            conn = connections_.front();
+            connections_.pop_front();
+        }
+        TraceSpan("wait_queue", "queue", conn->queued, WallTime());
+        if (HandleConnection(conn, &arena)) {
+            ReturnConnection(conn);
+        } else {
+            CloseConnection(conn);
+        }
+    }
+}
+
+#ifdef SOFIXER_HAVE_UNIX_SOCKET
+
+bool FixServer::Serve(const char *socket_path) {
+    // clients may go away before the answer is written
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        FLOGE("socket path %s is too long", socket_path);
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // only a socket left by a server that is gone is replaced
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            FLOGE("%s exists and is not a socket", socket_path);
+            return false;
+        }
+        auto probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        auto in_use = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (in_use) {
+            FLOGE("%s is used by another server", socket_path);
+            return false;
+        }
+        unlink(socket_path);
+    }
+
+    auto sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        FLOGE("unable to create socket: %s", strerror(errno));
+        return false;
+    }
+    // requests read and write files as this user, only the user may connect,
+    // nothing is accepted before listen
+    struct stat bound;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        FLOGE("unable to listen on %s: %s", socket_path, strerror(errno));
+        close(sock);
+        return false;
+    }
+    if (chmod(socket_path, 0600) != 0 || listen(sock, SOMAXCONN) != 0 ||
+        lstat(socket_path, &bound) != 0) {
+        FLOGE("unable to listen on %s: %s", socket_path, strerror(errno));
+        close(sock);
+        unlink(socket_path);
+        return false;
+    }
+    if (wake_[0] < 0 && (pipe(wake_) != 0 || fcntl(wake_[0], F_SETFL, O_NONBLOCK) != 0 ||
+                         fcntl(wake_[1], F_SETFL, O_NONBLOCK) != 0)) {
+        FLOGE("unable to create pipe: %s", strerror(errno));
+        close(sock);
+        unlink(socket_path);
+        return false;
+    }
+    FLOGI("serving on %s with %zu workers", socket_path, workers_.size());
+
+    // connections waiting for requests, polled with the listening socket
+    std::vector<Connection*> idle;
+    std::vector<struct pollfd> polled;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            idle.insert(idle.end(), returned_.begin(), returned_.end());
+            returned_.clear();
+        }
+        polled.clear();
+        polled.push_back({sock, POLLIN, 0});
+        polled.push_back({wake_[0], POLLIN, 0});
+        for (auto conn : idle) {
+            polled.push_back({conn->conn, POLLIN, 0});
+        }
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            FLOGE("poll failed: %s", strerror(errno));
+            break;
+        }
+        if (polled[1].revents != 0) {
+            char buf[64];
+            while (read(wake_[0], buf, sizeof(buf)) > 0) {}
+        }
+
+        // connections with requests or closed by client go to workers
+        size_t kept = 0, queued = 0;
+        for (size_t i = 0; i < idle.size(); i++) {
+            if (polled[i + 2].revents == 0) {
+                idle[kept++] = idle[i];
+                continue;
+            }
+            idle[i]->queued = WallTime();
+            std::lock_guard<std::mutex> guard(lock_);
+            connections_.push_back(idle[i]);
+            queued++;
+        }
+        idle.resize(kept);
+        if (queued == 1) {
+            ready_.notify_one();
+        } else if (queued > 1) {
+            ready_.notify_all();
+        }
+
+        if (polled[0].revents == 0) continue;
+        auto conn = TEMP_FAILURE_RETRY(accept(sock, nullptr, nullptr));
+        if (conn < 0) {
+            if (errno == ECONNABORTED) continue;
+            FLOGE("accept failed: %s", strerror(errno));
+            break;
+        }
+        auto accepted = new Connection();
+        accepted->conn = conn;
+        idle.push_back(accepted);
+    }
+    for (auto conn : idle) {
+        CloseConnection(conn);
+    }
+    close(sock);
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+        st.st_dev == bound.st_dev && st.st_ino == bound.st_ino) {
+        unlink(socket_path);
+    }
+    return false;
+}
+
+// longest request line, paths of a request are far shorter
+static const size_t kMaxRequestLength = 8192;
+
+static bool SendAnswer(int conn, const std::string& answer, int fd) {
+    struct iovec iov = {(void*)answer.c_str(), answer.length()};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (fd >= 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return TEMP_FAILURE_RETRY(sendmsg(conn, &msg, 0)) == (long)answer.length();
+}
+
+bool FixServer::HandleConnection(Connection* conn, JobArena* arena) {
+    char buf[4096];
+    // file descriptors are sent along with the request data
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * 16)];
+    } control;
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    auto rc = TEMP_FAILURE_RETRY(recvmsg(conn->conn, &msg, MSG_DONTWAIT));
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    if (rc <= 0) {
+        return false;
+    }
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        auto received = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+        for (size_t i = 0; i < count; i++) {
+            conn->fds.push_back(received[i]);
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        // the dropped descriptors would be taken as sources of later requests
+        FLOGE("file descriptors sent with requests are truncated, closing the connection");
+        SendAnswer(conn->conn, "error too many file descriptors are sent\n", -1);
+        return false;
+    }
+    conn->pending.append(buf, rc);
+
+    size_t end;
+    while ((end = conn->pending.find('\n')) != std::string::npos) {
+        auto line = conn->pending.substr(0, end);
+        conn->pending.erase(0, end + 1);
+        int answer_fd = -1;
+        auto answer = HandleRequest(line, conn->fds, &answer_fd, arena) + "\n";
+        auto sent = SendAnswer(conn->conn, answer, answer_fd);
+        if (answer_fd >= 0) {
+            close(answer_fd);
+        }
+        if (!sent) {
+            return false;
+        }
+    }
+    if (conn->pending.size() > kMaxRequestLength) {
+        FLOGE("request is longer than %zu bytes, closing the connection", kMaxRequestLength);
+        SendAnswer(conn->conn, "error request too long\n", -1);
+        return false;
+    }
+    return true;
+}
+
+void FixServer::CloseConnection(Connection* conn) {
+    for (auto fd : conn->fds) {
+        close(fd);
+    }
+    close(conn->conn);
+    delete conn;
+}
+
+void FixServer::ReturnConnection(Connection* conn) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        returned_.push_back(conn);
+    }
+    // a full pipe already wakes the serving thread
+    char wake = 0;
+    if (TEMP_FAILURE_RETRY(write(wake_[1], &wake, 1)) < 0 && errno != EAGAIN) {
+        FLOGE("unable to wake serving thread: %s", strerror(errno));
+    }
+}
+
+std::string FixServer::HandleRequest(const std::string &line, std::deque<int> &fds, int* answer_fd,
+                                     JobArena* arena) {
+    FixOptions job = defaults_;
+    if (!ParseFixJob(line, &job)) {
+        return "error bad request, expect: source output [memBaseAddr] [baseSoPath]";
+    }
+    if (job.source == "-") {
+        if (fds.empty()) {
+            return "error no source file descriptor is sent";
+        }
+        job.source_fd = fds.front();
+        fds.pop_front();
+        job.source = "fd:" + std::to_string(job.source_fd);
+    }
+    if (job.output == "-") {
+        job.output_fd = CreateOutputMemfd("sofixer-output");
+    }
+
+    TraceScope span("job", "job", job.source);
+    FLogJob log_job(job.source);
+    FixResult result;
+    job.arena = arena;
+    auto ok = job.output != "-" || job.output_fd >= 0;
+    ok = ok && FixSoFile(job, &result);
+    arena->Reset();
+    if (job.source_fd >= 0) {
+        close(job.source_fd);
+    }
+    if (!ok) {
+        if (job.output_fd >= 0) {
+            close(job.output_fd);
+        }
+        return "error unable to fix " + job.source;
+    }
+    if (job.output_fd >= 0) {
+        // an unsealed memfd may change under the receiver mapping it
+        if (!SealOutputMemfd(job.output_fd)) {
+            close(job.output_fd);
+            return "error unable to seal output of " + job.source;
+        }
+        *answer_fd = job.output_fd;
+    }
+    char answer[256];
+    snprintf(answer, sizeof(answer), "ok source_size=%zu output_size=%zu elapsed_ms=%.3f%s",
+             result.source_size, result.output_size, result.elapsed,
+             result.cached ? " cached=1" : "");
+    return answer;
+}
+
+#else
+
+bool FixServer::Serve(const char *socket_path) {
+    FLOGE("unix domain socket is not supported on this platform");
+    return false;
+}
+
+bool FixServer::HandleConnection(Connection* conn, JobArena* arena) {
+    return false;
+}
+
+void FixServer::CloseConnection(Connection* conn) {
+    delete conn;
+}
+
+void FixServer::ReturnConnection(Connection* conn) {
+    delete conn;
+}
+
+std::string FixServer::HandleRequest(const std::string &line, std::deque<int> &fds, int* answer_fd,
+                                     JobArena* arena) {
+    return "error not supported";
+}
+
+#endif
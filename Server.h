@@ -0,0 +1,81 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Keep SoFixer running and fix requests from a unix domain socket
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_SERVER_H
+#define SOFIXER_SERVER_H
+
+#include "Fixer.h"
+#include <deque>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+/**
+  Every request is a line with the same fields as a batch manifest line:
+
+      source output [memBaseAddr] [baseSoPath]
+
+  If source is "-", the source is the file descriptor sent with the request
+  by SCM_RIGHTS, a memfd sealed with F_SEAL_SHRINK is mapped directly.
+  If output is "-", the output is written to a new sealed memfd, which is
+  sent back with the answer. Every request is answered with one line:
+
+      ok source_size=<bytes> output_size=<bytes> elapsed_ms=<ms>
+      error <message>
+
+  Idle connections are polled by the serving thread, a connection with
+  data is handed to one of a fixed count of worker threads, which fixes
+  the complete requests received and gives the connection back. Requests
+  on the same connection are fixed in order.
+ **/
+class FixServer {
+public:
+    FixServer(const FixOptions& defaults, unsigned worker_count);
+    ~FixServer();
+
+    // Listen on socket_path and serve forever. Returns false on error.
+    bool Serve(const char* socket_path);
+
+private:
+    // a client connection and the data received but not handled yet
+    struct Connection {
+        int conn;
+        std::string pending;
+        std::deque<int> fds;
+        // when it is queued for a worker(WallTime)
+        double queued;
+    };
+    void WorkerLoop();
+    // Handle the requests received by one read of the connection, jobs of
+    // the worker take small allocations from arena. Returns false if the
+    // connection is to be closed.
+    bool HandleConnection(Connection* conn, JobArena* arena);
+    void CloseConnection(Connection* conn);
+    // give a connection back to the serving thread to be polled
+    void ReturnConnection(Connection* conn);
+    // answer_fd is set to the file descriptor sent with the answer
+    std::string HandleRequest(const std::string& line, std::deque<int>& fds, int* answer_fd,
+                              JobArena* arena);
+
+    FixOptions defaults_;
+    BaseSoCache baseso_cache_;
+    ImagePool image_pool_;
+    std::vector<std::thread> workers_;
+
+    std::mutex lock_;
+    std::condition_variable ready_;
+    // connections with data to be handled by workers
+    std::deque<Connection*> connections_;
+    // connections given back by workers, the serving thread is woken by
+    // writing to wake_[1]
+    std::vector<Connection*> returned_;
+    int wake_[2] = {-1, -1};
+    bool stopped_ = false;
+};
+
+
+#endif //SOFIXER_SERVER_H
@@ -0,0 +1,209 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "Stats.h"
+#include "Fixer.h"
+#include "FDebug.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+PhaseTimer::PhaseTimer(FixStats *stats, const char *name)
+        : stats_(stats), name_(name), traced_(TraceEnabled()) {
+    if (stats_ == nullptr && !traced_) {
+        return;
+    }
+    if (stats_ != nullptr) {
+        index_ = stats_->phases.size();
+        FixStats::Phase phase = {name, stats_->depth++, 0, 0, {}};
+        std::fill(phase.counters, phase.counters + PERF_COUNTER_COUNT, -1);
+        stats_->phases.push_back(phase);
+        cpu_start_ = ThreadCpuTime();
+        counted_ = ReadPerfCounters(counters_start_);
+    }
+    wall_start_ = WallTime();
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (stats_ == nullptr && !traced_) {
+        return;
+    }
+    auto wall_end = WallTime();
+    if (stats_ != nullptr) {
+        auto& phase = stats_->phases[index_];
+        phase.wall_ms = wall_end - wall_start_;
+        phase.cpu_ms = ThreadCpuTime() - cpu_start_;
+        int64_t counters[PERF_COUNTER_COUNT];
+        if (counted_ && ReadPerfCounters(counters)) {
+            for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+                if (counters[i] >= 0 && counters_start_[i] >= 0) {
+                    phase.counters[i] = counters[i] - counters_start_[i];
+                }
+            }
+        }
+        stats_->depth--;
+    }
+    if (traced_) {
+        TraceSpan(name_, "phase", wall_start_, wall_end);
+    }
+}
+
+static const char* reloc_table_names[RELOC_TABLE_COUNT] = {"rel", "plt_rel", "plt_rela"};
+static const char* reloc_outcome_names[RELOC_OUTCOME_COUNT] = {"applied", "skipped", "unresolved"};
+
+const char* RelocTableName(int table) {
+    return table >= 0 && table < RELOC_TABLE_COUNT ? reloc_table_names[table] : "unknown";
+}
+
+const char* RelocOutcomeName(int outcome) {
+    return outcome >= 0 && outcome < RELOC_OUTCOME_COUNT ? reloc_outcome_names[outcome] : "unknown";
+}
+
+std::map<unsigned, RelocHistogram::Counts> RelocHistogram::Types() const {
+    auto types = large_;
+    for (size_t type = 0; type < small_.size(); type++) {
+        if (small_[type].processed() != 0) {
+            types[type] = small_[type];
+        }
+    }
+    return types;
+}
+
+RelocHistogram::Counts RelocHistogram::Total() const {
+    Counts total;
+    for (auto& type : Types()) {
+        for (int i = 0; i < RELOC_OUTCOME_COUNT; i++) {
+            total.outcomes[i] += type.second.outcomes[i];
+        }
+    }
+    return total;
+}
+
+void TrackAlloc(FixStats *stats, const char *owner, int64_t size) {
+    if (stats == nullptr || size == 0) {
+        return;
+    }
+    auto& allocation = stats->allocations[owner];
+    allocation.bytes += size;
+    stats->alloc_bytes += size;
+    if (size > 0) {
+        allocation.count++;
+        allocation.peak = std::max(allocation.peak, allocation.bytes);
+        stats->alloc_peak = std::max(stats->alloc_peak, stats->alloc_bytes);
+    }
+}
+
+double WallTime() {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double ThreadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+    }
+#endif
+    return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+size_t PeakRss() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+std::string JsonString(const std::string& s) {
+    std::string json = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            json.push_back('\\');
+            json.push_back(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            json += escaped;
+        } else {
+            json.push_back(c);
+        }
+    }
+    json.push_back('"');
+    return json;
+}
+
+bool WriteStatsJson(const char *path, const std::vector<FixStats> &jobs, double wall_ms) {
+    auto fp = fopen(path, "w");
+    if (fp == nullptr) {
+        FLOGE("unable to write stats file %s", path);
+        return false;
+    }
+    fprintf(fp, "{\n  \"version\": \"%s\",\n  \"wall_ms\": %.3f,\n  \"peak_rss\": %zu,\n  \"jobs\": [",
+            SOFIXER_VERSION, wall_ms, PeakRss());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        auto& job = jobs[i];
+        fprintf(fp, "%s\n    {\"source\": %s, \"output\": %s", i == 0 ? "" : ",",
+                JsonString(job.source).c_str(), JsonString(job.output).c_str());
+        fprintf(fp, ", \"ok\": %s, \"bytes_read\": %llu, \"bytes_written\": %llu, \"sections\": %zu,\n",
+                job.ok ? "true" : "false", (unsigned long long)job.bytes_read,
+                (unsigned long long)job.bytes_written, job.sections);
+        fprintf(fp, "     \"relocations\": {");
+        for (int t = 0; t < RELOC_TABLE_COUNT; t++) {
+            fprintf(fp, "%s\"%s\": {", t == 0 ? "" : ", ", RelocTableName(t));
+            bool first = true;
+            for (auto& type : job.relocations[t].Types()) {
+                fprintf(fp, "%s\"%u\": {\"processed\": %llu", first ? "" : ", ", type.first,
+                        (unsigned long long)type.second.processed());
+                for (int k = 0; k < RELOC_OUTCOME_COUNT; k++) {
+                    fprintf(fp, ", \"%s\": %llu", RelocOutcomeName(k), (unsigned long long)type.second.outcomes[k]);
+                }
+                fputc('}', fp);
+                first = false;
+            }
+            fputc('}', fp);
+        }
+        fprintf(fp, "},\n     \"alloc_peak\": %llu, \"allocations\": {", (unsigned long long)job.alloc_peak);
+        bool first = true;
+        for (auto& allocation : job.allocations) {
+            fprintf(fp, "%s%s: {\"peak\": %llu, \"count\": %llu, \"held\": %llu}", first ? "" : ", ",
+                    JsonString(allocation.first).c_str(), (unsigned long long)allocation.second.peak,
+                    (unsigned long long)allocation.second.count, (unsigned long long)allocation.second.bytes);
+            first = false;
+        }
+        fprintf(fp, "},\n     \"phases\": [");
+        for (size_t j = 0; j < job.phases.size(); j++) {
+            auto& phase = job.phases[j];
+            fprintf(fp, "%s\n       {\"name\": \"%s\", \"depth\": %d, \"wall_ms\": %.3f, \"cpu_ms\": %.3f",
+                    j == 0 ? "" : ",", phase.name, phase.depth, phase.wall_ms, phase.cpu_ms);
+            for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+                if (phase.counters[k] >= 0) {
+                    fprintf(fp, ", \"%s\": %lld", PerfCounterName(k), (long long)phase.counters[k]);
+                }
+            }
+            fputc('}', fp);
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    auto ok = fclose(fp) == 0;
+    if (!ok) {
+        FLOGE("unable to write stats file %s", path);
+    }
+    return ok;
+}
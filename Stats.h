@@ -0,0 +1,139 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Time and counters of fix jobs
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_STATS_H
+#define SOFIXER_STATS_H
+
+#include "PerfCounters.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// Relocation tables of soinfo, named rel, plt_rel and plt_rela in stats.
+enum RelocTable {
+    RELOC_TABLE_REL,
+    RELOC_TABLE_PLT_REL,
+    RELOC_TABLE_PLT_RELA,
+    RELOC_TABLE_COUNT
+};
+
+// What fixing a relocation did: applied, skipped for unknown type, or
+// pointed to a fake address for a symbol not defined in the library.
+enum RelocOutcome {
+    RELOC_APPLIED,
+    RELOC_SKIPPED,
+    RELOC_UNRESOLVED,
+    RELOC_OUTCOME_COUNT
+};
+
+const char* RelocTableName(int table);
+const char* RelocOutcomeName(int outcome);
+
+// Relocation count by type and outcome, counted for every job.
+class RelocHistogram {
+public:
+    struct Counts {
+        uint64_t outcomes[RELOC_OUTCOME_COUNT];
+        Counts() { std::fill(outcomes, outcomes + RELOC_OUTCOME_COUNT, 0); }
+        uint64_t processed() const {
+            return outcomes[RELOC_APPLIED] + outcomes[RELOC_SKIPPED] + outcomes[RELOC_UNRESOLVED];
+        }
+    };
+
+    void Add(unsigned type, RelocOutcome outcome) {
+        if (type < 0x800) {
+            // types of known machines are small, count them without lookup
+            if (type >= small_.size()) {
+                small_.resize(type + 1);
+            }
+            small_[type].outcomes[outcome]++;
+        } else {
+            large_[type].outcomes[outcome]++;
+        }
+    }
+    // Counts of the types met, by type.
+    std::map<unsigned, Counts> Types() const;
+    Counts Total() const;
+
+private:
+    std::vector<Counts> small_;
+    std::map<unsigned, Counts> large_;
+};
+
+// Collected by reader, rebuilder and Fixer of one job if set, a job runs on
+// one thread at a time, so no lock is needed.
+struct FixStats {
+    struct Phase {
+        const char* name;
+        // phases run inside another phase have a larger depth
+        int depth;
+        double wall_ms;
+        double cpu_ms;
+        // events counted in the phase, -1 if not counted
+        int64_t counters[PERF_COUNTER_COUNT];
+    };
+
+    std::string source;
+    std::string output;
+    bool ok = false;
+    std::vector<Phase> phases;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    RelocHistogram relocations[RELOC_TABLE_COUNT];
+    size_t sections = 0;
+
+    // bytes held by each owner(load, phdr, rebuild_data ...), and the most
+    // it held at once
+    struct Allocation {
+        uint64_t bytes = 0;
+        uint64_t peak = 0;
+        uint64_t count = 0;
+    };
+    std::map<std::string, Allocation> allocations;
+    // the most held by all owners at once
+    uint64_t alloc_bytes = 0;
+    uint64_t alloc_peak = 0;
+
+    // depth of the running phase
+    int depth = 0;
+};
+
+// Measure wall and cpu time of the scope as a phase, and record it as a span
+// if trace is started. Nothing is done if stats is null and trace is off.
+class PhaseTimer {
+public:
+    PhaseTimer(FixStats* stats, const char* name);
+    ~PhaseTimer();
+
+private:
+    FixStats* stats_;
+    const char* name_;
+    bool traced_;
+    bool counted_ = false;
+    size_t index_ = 0;
+    double wall_start_ = 0;
+    double cpu_start_ = 0;
+    int64_t counters_start_[PERF_COUNTER_COUNT];
+};
+
+// Record size bytes allocated(or released if negative) by owner.
+void TrackAlloc(FixStats* stats, const char* owner, int64_t size);
+
+// Monotonic wall time and cpu time of the calling thread in milliseconds.
+double WallTime();
+double ThreadCpuTime();
+// Peak resident set size of the process in bytes, 0 if unknown.
+size_t PeakRss();
+
+// Quoted and escaped json string.
+std::string JsonString(const std::string& s);
+
+// Write stats of jobs as json.
+bool WriteStatsJson(const char* path, const std::vector<FixStats>& jobs, double wall_ms);
+
+#endif //SOFIXER_STATS_H
@@ -0,0 +1,101 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "Trace.h"
+#include "Stats.h"
+#include "FDebug.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+static std::mutex trace_lock;
+static FILE* trace_file = nullptr;
+static std::atomic<bool> trace_enabled(false);
+static double trace_start = 0;
+static bool trace_first_event = true;
+
+static int TraceThreadId() {
+    static std::atomic<int> next_tid(1);
+    static thread_local int tid = next_tid++;
+    return tid;
+}
+
+static void WriteEvent(const std::string& event) {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    if (trace_file == nullptr) {
+        return;
+    }
+    fprintf(trace_file, "%s\n%s", trace_first_event ? "" : ",", event.c_str());
+    trace_first_event = false;
+    fflush(trace_file);
+}
+
+bool StartTrace(const char *path) {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    trace_file = fopen(path, "w");
+    if (trace_file == nullptr) {
+        FLOGE("unable to write trace file %s", path);
+        return false;
+    }
+    fputc('[', trace_file);
+    trace_first_event = true;
+    trace_start = WallTime();
+    trace_enabled = true;
+    return true;
+}
+
+void StopTrace() {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    trace_enabled = false;
+    if (trace_file != nullptr) {
+        fprintf(trace_file, "\n]\n");
+        fclose(trace_file);
+        trace_file = nullptr;
+    }
+}
+
+bool TraceEnabled() {
+    return trace_enabled;
+}
+
+void TraceThreadName(const std::string &name) {
+    if (!trace_enabled) {
+        return;
+    }
+    char event[128];
+    snprintf(event, sizeof(event), "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+             TraceThreadId());
+    WriteEvent(event + JsonString(name) + "}}");
+}
+
+void TraceSpan(const std::string &name, const char *category, double start_ms, double end_ms,
+               const std::string &detail) {
+    if (!trace_enabled) {
+        return;
+    }
+    char times[160];
+    snprintf(times, sizeof(times), ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+             category, TraceThreadId(), (start_ms - trace_start) * 1000, (end_ms - start_ms) * 1000);
+    auto event = "{\"name\": " + JsonString(name) + times;
+    if (!detail.empty()) {
+        event += ", \"args\": {\"detail\": " + JsonString(detail) + "}";
+    }
+    WriteEvent(event + "}");
+}
+
+TraceScope::TraceScope(const std::string &name, const char *category, const std::string &detail)
+        : enabled_(trace_enabled), category_(category) {
+    if (enabled_) {
+        name_ = name;
+        detail_ = detail;
+        start_ = WallTime();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (enabled_) {
+        TraceSpan(name_, category_, start_, WallTime(), detail_);
+    }
+}
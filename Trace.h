@@ -0,0 +1,39 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Trace event file for chrome://tracing and ui.perfetto.dev
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_TRACE_H
+#define SOFIXER_TRACE_H
+
+#include <string>
+
+// Events are written as they end in the JSON array format, whose closing
+// bracket is optional, so a daemon killed at any time leaves a readable file.
+// Every thread has its own track.
+bool StartTrace(const char* path);
+void StopTrace();
+bool TraceEnabled();
+
+// Name the track of the calling thread.
+void TraceThreadName(const std::string& name);
+// Record [start_ms, end_ms) of WallTime() on the track of the calling thread.
+void TraceSpan(const std::string& name, const char* category, double start_ms, double end_ms,
+               const std::string& detail = std::string());
+
+// Record the scope as a span, nothing is done if trace is not started.
+class TraceScope {
+public:
+    TraceScope(const std::string& name, const char* category,
+               const std::string& detail = std::string());
+    ~TraceScope();
+
+private:
+    bool enabled_;
+    std::string name_;
+    const char* category_;
+    std::string detail_;
+    double start_ = 0;
+};
+
+#endif //SOFIXER_TRACE_H
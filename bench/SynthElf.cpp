@@ -0,0 +1,257 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "SynthElf.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// not in elf.h, the same numbers are used by ElfRebuilder::relocate
+#define SYNTH_EM_AARCH64 183
+#define SYNTH_R_AARCH64_JUMP_SLOT 0x402
+#define SYNTH_R_AARCH64_RELATIVE 0x403
+
+#define SYNTH_PHNUM 4
+#define SYNTH_DYN_COUNT 16
+
+static Elf_Addr Align(Elf_Addr value, Elf_Addr align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static size_t Gcd(size_t a, size_t b) {
+    while (b != 0) {
+        auto t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static unsigned ElfHash(const char* name) {
+    unsigned h = 0;
+    while (*name) {
+        h = (h << 4) + (uint8_t)*name++;
+        auto g = h & 0xf0000000;
+        h ^= g;
+        h ^= g >> 24;
+    }
+    return h;
+}
+
+static Elf_Addr RelInfo(size_t sym, unsigned type) {
+#ifdef __SO64__
+    return ELF64_R_INFO(sym, type);
+#else
+    return ELF32_R_INFO(sym, type);
+#endif
+}
+
+namespace {
+// xorshift32, the same options always give the same dump
+class SynthRandom {
+public:
+    explicit SynthRandom(uint32_t seed) : state_(seed != 0 ? seed : 1) {}
+    uint32_t Next() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_;
+    }
+
+private:
+    uint32_t state_;
+};
+}
+
+bool GenerateSynthElf(const SynthElfOptions& options, std::vector<uint8_t>* dump) {
+    if (options.relative_percent > 100) {
+        return false;
+    }
+    auto relative_count = options.relocations * options.relative_percent / 100;
+    auto jump_count = options.relocations - relative_count;
+    if (jump_count != 0 && options.symbols == 0) {
+        return false;
+    }
+    auto sym_count = options.symbols + 1;
+    auto nbucket = options.symbols / 2 + 1;
+    auto rel_size = options.rela ? sizeof(Elf_Rela) : sizeof(Elf_Rel);
+
+    uint16_t machine;
+    unsigned relative_type, jump_type;
+#ifdef __SO64__
+    if (options.rela) {
+        machine = SYNTH_EM_AARCH64;
+        relative_type = SYNTH_R_AARCH64_RELATIVE;
+        jump_type = SYNTH_R_AARCH64_JUMP_SLOT;
+    } else {
+        machine = EM_X86_64;
+        relative_type = R_X86_64_RELATIVE;
+        jump_type = R_X86_64_JUMP_SLOT;
+    }
+#else
+    machine = EM_ARM;
+    relative_type = R_ARM_RELATIVE;
+    jump_type = R_ARM_JUMP_SLOT;
+#endif
+
+    std::string strtab("\0libsynth.so", 13);
+    std::vector<Elf_Word> names(sym_count, 0);
+    for (size_t i = 1; i < sym_count; i++) {
+        names[i] = strtab.size();
+        strtab += "synth_sym_" + std::to_string(i);
+        strtab.push_back('\0');
+    }
+
+    // executable segment
+    Elf_Addr phdr_addr = sizeof(Elf_Ehdr);
+    Elf_Addr dynsym = Align(phdr_addr + SYNTH_PHNUM * sizeof(Elf_Phdr), 16);
+    Elf_Addr dynstr = dynsym + sym_count * sizeof(Elf_Sym);
+    Elf_Addr hash = Align(dynstr + strtab.size(), 8);
+    Elf_Addr reldyn = Align(hash + (2 + nbucket + sym_count) * sizeof(uint32_t), 8);
+    Elf_Addr relplt = reldyn + relative_count * rel_size;
+    Elf_Addr text = Align(relplt + jump_count * rel_size, 16);
+    Elf_Addr text_end = std::max<Elf_Addr>(text + 16, Align(options.text_size, 16));
+    Elf_Addr code_size = text_end - text;
+
+    // writable segment, the gap is not in the file
+    Elf_Addr gap = Align(options.segment_gap, PAGE_SIZE);
+    Elf_Addr data = Align(text_end, PAGE_SIZE) + gap;
+    Elf_Addr dynamic = data;
+    Elf_Addr got = Align(dynamic + SYNTH_DYN_COUNT * sizeof(Elf_Dyn), 16);
+    Elf_Addr pointers = got + (3 + jump_count) * sizeof(Elf_Addr);
+    auto pointer_slots = std::max<size_t>(relative_count, options.pointer_area / sizeof(Elf_Addr));
+    Elf_Addr data_end = pointers + pointer_slots * sizeof(Elf_Addr);
+    Elf_Addr bss_end = data_end + options.bss_size;
+    // addresses of symbols in other libraries
+    Elf_Addr external = options.base + Align(bss_end, PAGE_SIZE) + 0x100000;
+
+    dump->assign(Align(bss_end, PAGE_SIZE), 0);
+    auto image = dump->data();
+    SynthRandom random(options.seed);
+
+    auto ehdr = reinterpret_cast<Elf_Ehdr*>(image);
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+#ifdef __SO64__
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+#else
+    ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+#endif
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_type = ET_DYN;
+    ehdr->e_machine = machine;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = phdr_addr;
+    ehdr->e_ehsize = sizeof(Elf_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf_Phdr);
+    ehdr->e_phnum = SYNTH_PHNUM;
+    // section headers are not loaded, so they are never in dump
+    ehdr->e_shentsize = sizeof(Elf_Shdr);
+
+    auto phdr = reinterpret_cast<Elf_Phdr*>(image + phdr_addr);
+    auto set_phdr = [](Elf_Phdr* p, Elf_Word type, Elf_Word flags, Elf_Addr vaddr, Elf_Addr offset,
+                       Elf_Addr filesz, Elf_Addr memsz, Elf_Addr align) {
+        p->p_type = type;
+        p->p_flags = flags;
+        p->p_vaddr = p->p_paddr = vaddr;
+        p->p_offset = offset;
+        p->p_filesz = filesz;
+        p->p_memsz = memsz;
+        p->p_align = align;
+    };
+    set_phdr(&phdr[0], PT_PHDR, PF_R, phdr_addr, phdr_addr,
+             SYNTH_PHNUM * sizeof(Elf_Phdr), SYNTH_PHNUM * sizeof(Elf_Phdr), sizeof(Elf_Addr));
+    set_phdr(&phdr[1], PT_LOAD, PF_R | PF_X, 0, 0, text_end, text_end, PAGE_SIZE);
+    set_phdr(&phdr[2], PT_LOAD, PF_R | PF_W, data, data - gap, data_end - data, bss_end - data, PAGE_SIZE);
+    set_phdr(&phdr[3], PT_DYNAMIC, PF_R | PF_W, dynamic, dynamic - gap,
+             SYNTH_DYN_COUNT * sizeof(Elf_Dyn), SYNTH_DYN_COUNT * sizeof(Elf_Dyn), sizeof(Elf_Addr));
+
+    // odd symbols are defined here, even ones are imported
+    auto syms = reinterpret_cast<Elf_Sym*>(image + dynsym);
+    memcpy(image + dynstr, strtab.data(), strtab.size());
+    auto buckets = reinterpret_cast<uint32_t*>(image + hash);
+    auto chains = buckets + 2 + nbucket;
+    buckets[0] = nbucket;
+    buckets[1] = sym_count;
+    buckets += 2;
+    for (size_t i = 1; i < sym_count; i++) {
+        auto& sym = syms[i];
+        sym.st_name = names[i];
+        sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+        if (i % 2 == 1) {
+            sym.st_value = text + (random.Next() % code_size & ~(Elf_Addr)3);
+            sym.st_size = 16;
+            sym.st_shndx = 1;
+        }
+        auto bucket = ElfHash(strtab.c_str() + names[i]) % nbucket;
+        chains[i] = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    auto put_reloc = [&](Elf_Addr table, size_t index, Elf_Addr offset, size_t sym, unsigned type,
+                         Elf_Addr addend) {
+        if (options.rela) {
+            auto rela = reinterpret_cast<Elf_Rela*>(image + table) + index;
+            rela->r_offset = offset;
+            rela->r_info = RelInfo(sym, type);
+            rela->r_addend = addend;
+        } else {
+            auto rel = reinterpret_cast<Elf_Rel*>(image + table) + index;
+            rel->r_offset = offset;
+            rel->r_info = RelInfo(sym, type);
+        }
+    };
+    // the dump holds relocated values
+    auto slots = reinterpret_cast<Elf_Addr*>(image + pointers);
+    // slot i * stride % pointer_slots visits distinct slots with a stride
+    // coprime to the slot count
+    size_t stride = 1;
+    if (pointer_slots > relative_count) {
+        stride = 2654435761u % pointer_slots | 1;
+        while (Gcd(stride, pointer_slots) != 1) {
+            stride += 2;
+        }
+    }
+    for (size_t i = 0; i < relative_count; i++) {
+        auto target = text + random.Next() % code_size;
+        auto slot = (size_t)((uint64_t)i * stride % pointer_slots);
+        put_reloc(reldyn, i, pointers + slot * sizeof(Elf_Addr), 0, relative_type, target);
+        slots[slot] = options.base + target;
+    }
+    auto got_slots = reinterpret_cast<Elf_Addr*>(image + got);
+    got_slots[0] = dynamic;
+    for (size_t i = 0; i < jump_count; i++) {
+        auto sym = 1 + i % options.symbols;
+        put_reloc(relplt, i, got + (3 + i) * sizeof(Elf_Addr), sym, jump_type, 0);
+        got_slots[3 + i] = syms[sym].st_value != 0 ? options.base + syms[sym].st_value :
+                           external + sym * 16;
+    }
+
+    for (auto p = reinterpret_cast<uint32_t*>(image + text), end = p + code_size / 4; p < end; p++) {
+        *p = random.Next();
+    }
+
+    auto dyn = reinterpret_cast<Elf_Dyn*>(image + dynamic);
+    auto put_dyn = [&](int tag, Elf_Addr value) {
+        dyn->d_tag = tag;
+        dyn->d_un.d_val = value;
+        dyn++;
+    };
+    put_dyn(DT_SONAME, 1);
+    put_dyn(DT_HASH, hash);
+    put_dyn(DT_STRTAB, dynstr);
+    put_dyn(DT_SYMTAB, dynsym);
+    put_dyn(DT_STRSZ, strtab.size());
+    put_dyn(DT_SYMENT, sizeof(Elf_Sym));
+    put_dyn(DT_PLTGOT, got);
+    put_dyn(options.rela ? DT_RELA : DT_REL, reldyn);
+    put_dyn(options.rela ? DT_RELASZ : DT_RELSZ, relative_count * rel_size);
+    put_dyn(options.rela ? DT_RELAENT : DT_RELENT, rel_size);
+    put_dyn(DT_JMPREL, relplt);
+    put_dyn(DT_PLTRELSZ, jump_count * rel_size);
+    put_dyn(DT_PLTREL, options.rela ? DT_RELA : DT_REL);
+    put_dyn(DT_NULL, 0);
+    return true;
+}
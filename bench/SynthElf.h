@@ -0,0 +1,44 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Generate fake memory dumps of a shared library for benchmark
+//===----------------------------------------------------------------------===//
+#ifndef SOFIXER_SYNTHELF_H
+#define SOFIXER_SYNTHELF_H
+
+#include "macros.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The library has an executable segment with the dynamic symbol, string,
+// hash and relocation tables followed by code, and a writable segment with
+// .dynamic, .got, pointers relocated relative to base and .bss.  Machine is
+// aarch64 for 64bit RELA, x86_64 for 64bit REL and arm for 32bit.
+struct SynthElfOptions {
+#ifdef __SO64__
+    Elf_Addr base = 0x7f0000000000;
+    bool rela = true;
+#else
+    Elf_Addr base = 0xf0000000;
+    bool rela = false;
+#endif
+    // size of the executable segment
+    size_t text_size = 1 << 20;
+    // unmapped space between the two segments, which is zero in dump
+    size_t segment_gap = 0;
+    size_t relocations = 10000;
+    // percent of relative relocations, the rest are plt jump slots
+    unsigned relative_percent = 90;
+    // spread the pointers of relative relocations over an area of the size
+    // in random order(like vtables of a large library), 0 to pack them
+    size_t pointer_area = 0;
+    size_t symbols = 1000;
+    size_t bss_size = 64 << 10;
+    uint32_t seed = 1;
+};
+
+// Returns false if the options describe nothing to load.
+bool GenerateSynthElf(const SynthElfOptions& options, std::vector<uint8_t>* dump);
+
+#endif //SOFIXER_SYNTHELF_H
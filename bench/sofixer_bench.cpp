@@ -0,0 +1,326 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Benchmark rebuild phases with generated dumps
+//
+//   sofixer_bench                      run every preset
+//   sofixer_bench -p large -n 10       run a preset 10 times
+//   sofixer_bench -r 1000000 -y 50000  change the library of every preset
+//   sofixer_bench -p small -w fake.so  write the dump instead, for SoFixer
+//   sofixer_bench -p large -H          compare normal and huge pages
+//
+// The best time of the iterations is reported for each phase.
+//===----------------------------------------------------------------------===//
+#include "SynthElf.h"
+#include "Fixer.h"
+#include "FDebug.h"
+#include <functional>
+#include <getopt.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* short_options = "hdHp:n:s:g:r:R:a:y:z:m:w:";
+const struct option long_options[] = {
+        {"help", 0, NULL, 'h'},
+        {"debug", 0, NULL, 'd'},
+        {"preset", 1, NULL, 'p'},
+        {"iterations", 1, NULL, 'n'},
+        {"size", 1, NULL, 's'},
+        {"gap", 1, NULL, 'g'},
+        {"relocs", 1, NULL, 'r'},
+        {"relative", 1, NULL, 'R'},
+        {"pointer-area", 1, NULL, 'a'},
+        {"symbols", 1, NULL, 'y'},
+        {"bss", 1, NULL, 'z'},
+        {"memso", 1, NULL, 'm'},
+        {"write", 1, NULL, 'w'},
+        {"huge-pages", 0, NULL, 'H'},
+        {"rel", 0, NULL, 0x100},
+        {"rela", 0, NULL, 0x101},
+        {nullptr, 0, nullptr, 0}
+};
+
+// phases measured, as named by PhaseTimer
+static const char* bench_phases[] = {"load", "rebuild_relocs", "rebuild_shdr", "rebuild_fin"};
+
+struct BenchPreset {
+    const char* name;
+    SynthElfOptions options;
+};
+
+static std::vector<BenchPreset> Presets() {
+    std::vector<BenchPreset> presets(5);
+    presets[0].name = "small";
+    presets[0].options.text_size = 512 << 10;
+    presets[0].options.relocations = 5000;
+    presets[0].options.symbols = 500;
+
+    // a large library such as libunity.so
+    presets[1].name = "large";
+    presets[1].options.text_size = 32 << 20;
+    presets[1].options.relocations = 500000;
+    presets[1].options.symbols = 20000;
+    presets[1].options.bss_size = 1 << 20;
+
+    // unmapped space between segments is dumped as zero
+    presets[2].name = "gap";
+    presets[2].options.text_size = 4 << 20;
+    presets[2].options.segment_gap = 64 << 20;
+    presets[2].options.relocations = 50000;
+    presets[2].options.symbols = 5000;
+
+    presets[3].name = "plt";
+    presets[3].options.text_size = 4 << 20;
+    presets[3].options.relocations = 200000;
+    presets[3].options.relative_percent = 10;
+    presets[3].options.symbols = 50000;
+
+    // relocated pointers spread over a large image, bound by TLB misses
+    presets[4].name = "scatter";
+    presets[4].options.text_size = 4 << 20;
+    presets[4].options.pointer_area = 256 << 20;
+    presets[4].options.relocations = 2000000;
+    presets[4].options.symbols = 5000;
+    return presets;
+}
+
+// Bytes of anonymous memory on huge pages, -1 if unknown.
+static long long AnonHugePages() {
+    auto fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp == nullptr) {
+        return -1;
+    }
+    long long kb = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        if (sscanf(line, "AnonHugePages: %lld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return kb < 0 ? -1 : kb << 10;
+}
+
+// Fix the preset, images are taken from a pool like the jobs of batch mode.
+// Time of rebuild_relocs is returned in relocs_ms.
+static bool RunPreset(const BenchPreset& preset, unsigned iterations, bool huge_pages,
+                      double* relocs_ms) {
+    std::vector<uint8_t> dump;
+    if (!GenerateSynthElf(preset.options, &dump)) {
+        FLOGE("unable to generate dump of preset %s", preset.name);
+        return false;
+    }
+    FixOptions fix;
+    fix.source = preset.name;
+    fix.dump_base = preset.options.base;
+
+    std::map<std::string, double> best;
+    double best_total = 0;
+    FixStats stats;
+    // reused by iterations like a worker of batch mode
+    JobArena arena;
+    fix.arena = &arena;
+    // keeps the images of all sizes, iterations reuse them
+    ImagePool image_pool(SIZE_MAX);
+    if (huge_pages && !image_pool.setHugePages(true)) {
+        return false;
+    }
+    fix.image_pool = &image_pool;
+    for (unsigned i = 0; i < iterations; i++) {
+        stats = FixStats();
+        fix.stats = &stats;
+        arena.Reset();
+        FixBuffer output;
+        FixResult result;
+        if (!FixSoBuffer(dump.data(), dump.size(), fix, &output, &result)) {
+            FLOGE("unable to fix dump of preset %s", preset.name);
+            return false;
+        }
+        std::map<std::string, double> times;
+        for (auto& phase : stats.phases) {
+            times[phase.name] += phase.wall_ms;
+        }
+        for (auto& time : times) {
+            auto it = best.find(time.first);
+            if (it == best.end() || time.second < it->second) {
+                best[time.first] = time.second;
+            }
+        }
+        if (i == 0 || result.elapsed < best_total) {
+            best_total = result.elapsed;
+        }
+    }
+
+    auto mb = dump.size() / 1048576.0;
+    auto relocations = (double)preset.options.relocations;
+    printf("%s%s: dump %.2f MB, %zu relocations (%u%% relative, %s), %zu symbols, gap %zu, bss %zu\n",
+           preset.name, huge_pages ? " (huge pages)" : "", mb, preset.options.relocations, preset.options.relative_percent,
+           preset.options.rela ? "rela" : "rel", preset.options.symbols,
+           preset.options.segment_gap, preset.options.bss_size);
+    printf("  %-16s %10s %12s %14s\n", "phase", "ms", "MB/s", "relocs/s");
+    auto print_phase = [&](const char* name, double ms) {
+        auto seconds = ms / 1000;
+        printf("  %-16s %10.3f %12.1f %14.0f\n", name, ms,
+               seconds > 0 ? mb / seconds : 0, seconds > 0 ? relocations / seconds : 0);
+    };
+    for (auto name : bench_phases) {
+        print_phase(name, best[name]);
+    }
+    print_phase("total", best_total);
+    printf("  %-16s %10.1f KB:", "alloc_peak", stats.alloc_peak / 1024.0);
+    for (auto& allocation : stats.allocations) {
+        printf(" %s %.1f KB", allocation.first.c_str(), allocation.second.peak / 1024.0);
+    }
+    printf("\n");
+    if (huge_pages) {
+        // images are still kept by the pool
+        auto huge = AnonHugePages();
+        printf("  %-16s %10.1f MB\n", "huge_pages", huge >= 0 ? huge / 1048576.0 : 0);
+    }
+    *relocs_ms = best["rebuild_relocs"];
+    return true;
+}
+
+void useage() {
+    printf("Useage: sofixer_bench <option(s)>\n");
+    printf(" Generate dumps of fake libraries, and measure load and rebuild phases of SoFixer\n");
+    printf(" Options are:\n");
+    printf("  -p --preset name                  Run only the preset(small, large, gap, plt, scatter)\n");
+    printf("  -n --iterations count             Fix every dump count times(default: 5)\n");
+    printf("  -s --size size(K/M/G)             Size of the executable segment\n");
+    printf("  -g --gap size(K/M/G)              Unmapped space between the segments\n");
+    printf("  -r --relocs count                 Relocation count\n");
+    printf("  -R --relative percent             Percent of relative relocations, the rest are plt jump slots\n");
+    printf("  -a --pointer-area size(K/M/G)     Spread pointers of relative relocations over the area\n");
+    printf("  -y --symbols count                Dynamic symbol count\n");
+    printf("  -z --bss size(K/M/G)              Size of .bss\n");
+    printf("  -m --memso memBaseAddr(16bit format)  Address the dump is taken from\n");
+    printf("     --rel / --rela                 Relocation table format\n");
+    printf("  -w --write path                   Write the dump of the preset to path instead of benchmark\n");
+    printf("  -H --huge-pages                   Also run with images on huge pages, and compare rebuild_relocs\n");
+    printf("  -d --debug                        Show log of SoFixer\n");
+    printf("  -h --help                         Display this information\n");
+}
+
+int main(int argc, char* argv[]) {
+    std::string preset_name, write;
+    unsigned iterations = 5;
+    bool huge_pages = false;
+    std::vector<std::function<void(SynthElfOptions&)>> changes;
+    FLogSetLevel(FLOG_LEVEL_WARN);
+
+    int c;
+    while ((c = getopt_long(argc, argv, short_options, long_options, nullptr)) != -1) {
+        std::string arg = optarg != nullptr ? optarg : "";
+        size_t size = 0;
+        if ((c == 's' || c == 'g' || c == 'a' || c == 'z') && !ParseSize(arg.c_str(), &size)) {
+            FLOGE("bad size of -%c: %s", c, arg.c_str());
+            return -1;
+        }
+        switch (c) {
+            case 'd':
+                FLogSetLevel(FLOG_LEVEL_DEBUG);
+                break;
+            case 'H':
+                huge_pages = true;
+                break;
+            case 'p':
+                preset_name = arg;
+                break;
+            case 'n':
+                iterations = strtoul(arg.c_str(), 0, 10);
+                break;
+            case 's':
+                changes.push_back([size](SynthElfOptions& o) { o.text_size = size; });
+                break;
+            case 'g':
+                changes.push_back([size](SynthElfOptions& o) { o.segment_gap = size; });
+                break;
+            case 'r':
+                changes.push_back([arg](SynthElfOptions& o) { o.relocations = strtoull(arg.c_str(), 0, 10); });
+                break;
+            case 'R':
+                changes.push_back([arg](SynthElfOptions& o) { o.relative_percent = strtoul(arg.c_str(), 0, 10); });
+                break;
+            case 'a':
+                changes.push_back([size](SynthElfOptions& o) { o.pointer_area = size; });
+                break;
+            case 'y':
+                changes.push_back([arg](SynthElfOptions& o) { o.symbols = strtoull(arg.c_str(), 0, 10); });
+                break;
+            case 'z':
+                changes.push_back([size](SynthElfOptions& o) { o.bss_size = size; });
+                break;
+            case 'm':
+                changes.push_back([arg](SynthElfOptions& o) { o.base = strtoull(arg.c_str(), 0, 16); });
+                break;
+            case 'w':
+                write = arg;
+                break;
+            case 0x100:
+            case 0x101:
+                changes.push_back([c](SynthElfOptions& o) { o.rela = c == 0x101; });
+                break;
+            default:
+                useage();
+                return c == 'h' ? 0 : -1;
+        }
+    }
+    if (iterations == 0) {
+        useage();
+        return -1;
+    }
+
+    std::vector<BenchPreset> presets;
+    for (auto& preset : Presets()) {
+        if (preset_name.empty() || preset_name == preset.name) {
+            for (auto& change : changes) {
+                change(preset.options);
+            }
+            presets.push_back(preset);
+        }
+    }
+    if (presets.empty()) {
+        FLOGE("unknown preset %s", preset_name.c_str());
+        return -1;
+    }
+
+    if (!write.empty()) {
+        std::vector<uint8_t> dump;
+        if (!GenerateSynthElf(presets[0].options, &dump)) {
+            FLOGE("unable to generate dump of preset %s", presets[0].name);
+            return -1;
+        }
+        FixOptions fix;
+        fix.output = write;
+        if (!WriteFixOutput(fix, dump.data(), dump.size())) {
+            return -1;
+        }
+        printf("%s: base 0x%llx, %zu bytes\n", write.c_str(),
+               (unsigned long long)presets[0].options.base, dump.size());
+        return 0;
+    }
+
+    // setHugePages warns when transparent huge pages are disabled
+    ImagePool probe;
+    if (huge_pages && !probe.setHugePages(true)) {
+        FLOGW("huge pages are not available, the comparison is skipped");
+        huge_pages = false;
+    }
+    for (auto& preset : presets) {
+        double normal_ms, huge_ms;
+        if (!RunPreset(preset, iterations, false, &normal_ms)) {
+            return 1;
+        }
+        if (huge_pages) {
+            if (!RunPreset(preset, iterations, true, &huge_ms)) {
+                return 1;
+            }
+            printf("  rebuild_relocs %.3f ms -> %.3f ms on huge pages (%.2fx)\n", normal_ms, huge_ms,
+                   huge_ms > 0 ? normal_ms / huge_ms : 0);
+        }
+    }
+    return 0;
+}
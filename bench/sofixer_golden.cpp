@@ -0,0 +1,382 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Check outputs of real dumps against known-good ones, and track time
+//
+//   sofixer_golden corpusDir -r results.tsv
+//   sofixer_golden corpusDir -r new.tsv -C old.tsv -t 10
+//   sofixer_golden corpusDir -u            rewrite the expected outputs
+//
+// corpusDir/corpus.txt lists the files as batch manifest does, paths are
+// relative to corpusDir:
+//
+//   libfoo.dump libfoo.so 0x7db078b000 [baseso]
+//
+// Every file is fixed in a child process, so that its peak memory is its
+// own.  The output is compared with the expected one byte by byte, and
+// section by section if they differ.  Results are written as tab separated
+// lines: source status best_ms peak_kb detail.
+//===----------------------------------------------------------------------===//
+#include "Fixer.h"
+#include "FDebug.h"
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <map>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const char* short_options = "hdcn:r:C:t:u";
+const struct option long_options[] = {
+        {"help", 0, NULL, 'h'},
+        {"debug", 0, NULL, 'd'},
+        {"compact", 0, NULL, 'c'},
+        {"iterations", 1, NULL, 'n'},
+        {"results", 1, NULL, 'r'},
+        {"compare", 1, NULL, 'C'},
+        {"threshold", 1, NULL, 't'},
+        {"update", 0, NULL, 'u'},
+        {nullptr, 0, nullptr, 0}
+};
+
+struct GoldenResult {
+    std::string source;
+    std::string status;
+    double ms = 0;
+    size_t peak_kb = 0;
+    std::string detail;
+};
+
+static std::string CorpusPath(const std::string& dir, const std::string& path) {
+    return path.empty() || path[0] == '/' ? path : dir + "/" + path;
+}
+
+static bool LoadCorpus(const std::string& dir, const FixOptions& defaults, std::vector<FixOptions>* jobs) {
+    auto path = dir + "/corpus.txt";
+    std::ifstream corpus(path);
+    if (!corpus) {
+        FLOGE("unable to open %s", path.c_str());
+        return false;
+    }
+    std::string line;
+    size_t line_num = 0;
+    while (std::getline(corpus, line)) {
+        line_num++;
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        FixOptions job = defaults;
+        if (!ParseFixJob(line, &job)) {
+            FLOGE("%s:%zu: expected output path is missing", path.c_str(), line_num);
+            return false;
+        }
+        job.source = CorpusPath(dir, job.source);
+        job.output = CorpusPath(dir, job.output);
+        job.baseso = CorpusPath(dir, job.baseso);
+        jobs->push_back(job);
+    }
+    return true;
+}
+
+// Section headers by name, false if data is not an elf file of our class.
+static bool ReadSections(const std::vector<uint8_t>& data, std::map<std::string, Elf_Shdr>* sections) {
+    if (data.size() < sizeof(Elf_Ehdr) || memcmp(data.data(), ELFMAG, SELFMAG) != 0) {
+        return false;
+    }
+    auto ehdr = reinterpret_cast<const Elf_Ehdr*>(data.data());
+    if (ehdr->e_shentsize != sizeof(Elf_Shdr) || ehdr->e_shstrndx >= ehdr->e_shnum ||
+        ehdr->e_shoff > data.size() || (data.size() - ehdr->e_shoff) / sizeof(Elf_Shdr) < ehdr->e_shnum) {
+        return false;
+    }
+    auto shdrs = reinterpret_cast<const Elf_Shdr*>(data.data() + ehdr->e_shoff);
+    auto& shstrtab = shdrs[ehdr->e_shstrndx];
+    if (shstrtab.sh_offset > data.size() || data.size() - shstrtab.sh_offset < shstrtab.sh_size) {
+        return false;
+    }
+    auto names = reinterpret_cast<const char*>(data.data() + shstrtab.sh_offset);
+    for (size_t i = 1; i < ehdr->e_shnum; i++) {
+        std::string name = shdrs[i].sh_name < shstrtab.sh_size ?
+                names + shdrs[i].sh_name : "#" + std::to_string(i);
+        (*sections)[name] = shdrs[i];
+    }
+    return true;
+}
+
+static bool SectionData(const std::vector<uint8_t>& data, const Elf_Shdr& shdr, const uint8_t** start) {
+    if (shdr.sh_type == SHT_NOBITS || shdr.sh_offset > data.size() ||
+        data.size() - shdr.sh_offset < shdr.sh_size) {
+        return false;
+    }
+    *start = data.data() + shdr.sh_offset;
+    return true;
+}
+
+// Names of sections that differ, or why the files cannot be compared.
+static std::string CompareSections(const std::vector<uint8_t>& output, const std::vector<uint8_t>& expected) {
+    std::map<std::string, Elf_Shdr> output_sections, expected_sections;
+    if (!ReadSections(output, &output_sections) || !ReadSections(expected, &expected_sections)) {
+        return "no_section_table";
+    }
+    std::string detail;
+    auto add = [&detail](const std::string& name, const char* what) {
+        detail += (detail.empty() ? "" : ",") + name + ":" + what;
+    };
+    for (auto& it : expected_sections) {
+        auto found = output_sections.find(it.first);
+        if (found == output_sections.end()) {
+            add(it.first, "missing");
+            continue;
+        }
+        auto& a = found->second;
+        auto& b = it.second;
+        if (a.sh_type != b.sh_type || a.sh_flags != b.sh_flags || a.sh_addr != b.sh_addr ||
+            a.sh_size != b.sh_size || a.sh_link != b.sh_link || a.sh_entsize != b.sh_entsize) {
+            add(it.first, "header");
+            continue;
+        }
+        const uint8_t* a_data = nullptr;
+        const uint8_t* b_data = nullptr;
+        if (SectionData(output, a, &a_data) && SectionData(expected, b, &b_data) &&
+            memcmp(a_data, b_data, a.sh_size) != 0) {
+            add(it.first, "data");
+        }
+    }
+    for (auto& it : output_sections) {
+        if (expected_sections.count(it.first) == 0) {
+            add(it.first, "extra");
+        }
+    }
+    // the same sections placed or padded differently
+    return detail.empty() ? "layout" : detail;
+}
+
+// Runs in the child process, the result line is written to fd.
+static void CheckFile(const FixOptions& job, unsigned iterations, bool update, int fd) {
+    std::string status, detail;
+    double best = 0;
+    std::vector<uint8_t> dump, expected;
+    FixBuffer output;
+    if (!ReadFixSource(job, &dump)) {
+        status = "failed";
+        detail = "unable_to_read_source";
+    }
+    for (unsigned i = 0; status.empty() && i < iterations; i++) {
+        FixResult result;
+        output = FixBuffer();
+        if (!FixSoBuffer(dump.data(), dump.size(), job, &output, &result)) {
+            status = "failed";
+            detail = "unable_to_fix";
+        } else if (i == 0 || result.elapsed < best) {
+            best = result.elapsed;
+        }
+    }
+    if (status.empty() && update) {
+        status = WriteFixOutput(job, output.data.get(), output.size) ? "updated" : "failed";
+    }
+    if (status.empty()) {
+        FixOptions golden;
+        golden.source = job.output;
+        if (!ReadFixSource(golden, &expected)) {
+            status = "failed";
+            detail = "unable_to_read_expected";
+        } else if (expected.size() == output.size &&
+                   memcmp(expected.data(), output.data.get(), output.size) == 0) {
+            status = "same";
+        } else {
+            status = "differ";
+            detail = CompareSections(std::vector<uint8_t>(output.data.get(), output.data.get() + output.size),
+                                     expected);
+        }
+    }
+    auto line = status + "\t" + std::to_string(best) + "\t" + detail + "\n";
+    auto written = write(fd, line.data(), line.size());
+    (void)written;
+}
+
+static bool RunFile(const FixOptions& job, unsigned iterations, bool update, GoldenResult* result) {
+    result->source = job.source;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        FLOGE("unable to create pipe: %s", strerror(errno));
+        return false;
+    }
+    fflush(stdout);
+    auto pid = fork();
+    if (pid < 0) {
+        FLOGE("unable to fork: %s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        CheckFile(job, iterations, update, fds[1]);
+        fflush(stdout);
+        _exit(0);
+    }
+    close(fds[1]);
+    std::string line;
+    char buf[1024];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+        line.append(buf, n);
+    }
+    close(fds[0]);
+    int wstatus = 0;
+    struct rusage usage;
+    if (wait4(pid, &wstatus, 0, &usage) != pid) {
+        FLOGE("unable to wait for %s", job.source.c_str());
+        return false;
+    }
+    result->peak_kb = usage.ru_maxrss;
+    std::istringstream fields(line);
+    std::getline(fields, result->status, '\t');
+    fields >> result->ms;
+    fields.ignore(1);
+    std::getline(fields, result->detail);
+    if (result->status.empty()) {
+        result->status = "crashed";
+        result->detail = WIFSIGNALED(wstatus) ? "signal_" + std::to_string(WTERMSIG(wstatus)) : "";
+    }
+    return true;
+}
+
+static bool LoadResults(const char* path, std::map<std::string, GoldenResult>* results) {
+    std::ifstream file(path);
+    if (!file) {
+        FLOGE("unable to open results file %s", path);
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        GoldenResult result;
+        std::istringstream fields(line);
+        std::getline(fields, result.source, '\t');
+        std::getline(fields, result.status, '\t');
+        fields >> result.ms >> result.peak_kb;
+        (*results)[result.source] = result;
+    }
+    return true;
+}
+
+static bool WriteResults(const char* path, const std::vector<GoldenResult>& results) {
+    FILE* fp = fopen(path, "w");
+    if (fp == nullptr) {
+        FLOGE("unable to write results file %s", path);
+        return false;
+    }
+    fprintf(fp, "# source\tstatus\tbest_ms\tpeak_kb\tdetail\n");
+    for (auto& result : results) {
+        fprintf(fp, "%s\t%s\t%.3f\t%zu\t%s\n", result.source.c_str(), result.status.c_str(),
+                result.ms, result.peak_kb, result.detail.c_str());
+    }
+    return fclose(fp) == 0;
+}
+
+void useage() {
+    printf("Useage: sofixer_golden <option(s)> corpusDir\n");
+    printf(" Fix the dumps listed in corpusDir/corpus.txt(source expected [memBaseAddr] [baseso])\n");
+    printf(" and compare the outputs with the expected ones\n");
+    printf(" Options are:\n");
+    printf("  -n --iterations count             Fix every dump count times, the best time is kept(default: 3)\n");
+    printf("  -r --results path                 Write status, time and peak memory of every file to path\n");
+    printf("  -C --compare path                 Compare time with results written before\n");
+    printf("  -t --threshold percent            Files slower than compared results by percent fail(default: 10)\n");
+    printf("  -u --update                       Write the outputs as the expected ones\n");
+    printf("  -c --compact                      Pack segments in file instead of p_offset = p_vaddr\n");
+    printf("  -d --debug                        Show log of SoFixer\n");
+    printf("  -h --help                         Display this information\n");
+}
+
+int main(int argc, char* argv[]) {
+    FixOptions defaults;
+    std::string results_path, compare_path;
+    unsigned iterations = 3;
+    double threshold = 10;
+    bool update = false;
+    FLogSetLevel(FLOG_LEVEL_WARN);
+
+    int c;
+    while ((c = getopt_long(argc, argv, short_options, long_options, nullptr)) != -1) {
+        switch (c) {
+            case 'd':
+                FLogSetLevel(FLOG_LEVEL_DEBUG);
+                break;
+            case 'c':
+                defaults.compact = true;
+                break;
+            case 'n':
+                iterations = strtoul(optarg, 0, 10);
+                break;
+            case 'r':
+                results_path = optarg;
+                break;
+            case 'C':
+                compare_path = optarg;
+                break;
+            case 't':
+                threshold = strtod(optarg, nullptr);
+                break;
+            case 'u':
+                update = true;
+                break;
+            default:
+                useage();
+                return c == 'h' ? 0 : -1;
+        }
+    }
+    if (optind + 1 != argc || iterations == 0) {
+        useage();
+        return -1;
+    }
+
+    std::vector<FixOptions> jobs;
+    if (!LoadCorpus(argv[optind], defaults, &jobs)) {
+        return -1;
+    }
+    std::map<std::string, GoldenResult> previous;
+    if (!compare_path.empty() && !LoadResults(compare_path.c_str(), &previous)) {
+        return -1;
+    }
+
+    std::vector<GoldenResult> results(jobs.size());
+    size_t failed = 0, slower = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        auto& result = results[i];
+        if (!RunFile(jobs[i], iterations, update, &result)) {
+            return 1;
+        }
+        auto ok = result.status == "same" || result.status == "updated";
+        std::string change;
+        auto it = previous.find(result.source);
+        if (it != previous.end() && it->second.ms > 0) {
+            auto percent = (result.ms / it->second.ms - 1) * 100;
+            char buf[64];
+            snprintf(buf, sizeof(buf), " %+.1f%%", percent);
+            change = buf;
+            if (percent > threshold) {
+                change += " SLOWER";
+                slower++;
+            }
+        }
+        if (!ok) {
+            failed++;
+        }
+        printf("%-8s %10.3f ms %10zu KB%s  %s %s\n", result.status.c_str(), result.ms, result.peak_kb,
+               change.c_str(), result.source.c_str(), result.detail.c_str());
+    }
+    if (!results_path.empty() && !WriteResults(results_path.c_str(), results)) {
+        return 1;
+    }
+    printf("%zu files, %zu failed, %zu slower than %.1f%%\n", jobs.size(), failed, slower, threshold);
+    return failed == 0 && slower == 0 ? 0 : 1;
+}
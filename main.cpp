@@ -1,9 +1,15 @@
 #include <iostream>
-#include "ObElfReader.h"
-#include "ElfRebuilder.h"
+#include "Fixer.h"
+#include "Batch.h"
+#include "Server.h"
 #include "FDebug.h"
+#include "PerfCounters.h"
+#include "Trace.h"
 #include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef __SO64__
 #define TARGET_NAME "SoFixer64"
@@ -12,7 +18,7 @@
 #endif
 
 
-const char* short_options = "hdm:s:o:b:";
+const char* short_options = "hdcm:s:o:b:B:j:M:S:";
 const struct option long_options[] = {
         {"help", 0, NULL, 'h'},
         {"debug", 0, NULL, 'd'},
@@ -20,116 +26,253 @@ const struct option long_options[] = {
         {"source", 1, NULL, 's'},
         {"baseso", 1, NULL, 'b'},
         {"output", 1, NULL, 'o'},
+        {"compact", 0, NULL, 'c'},
+        {"batch", 1, NULL, 'B'},
+        {"jobs", 1, NULL, 'j'},
+        {"mem-budget", 1, NULL, 'M'},
+        {"serve", 1, NULL, 'S'},
+        {"source-fd", 1, NULL, 0x100},
+        {"output-fd", 1, NULL, 0x101},
+        {"cache-dir", 1, NULL, 0x102},
+        {"page-store", 1, NULL, 0x103},
+        {"restore", 1, NULL, 0x104},
+        {"previous", 1, NULL, 0x105},
+        {"refix-data", 0, NULL, 0x106},
+        {"stats-json", 1, NULL, 0x107},
+        {"trace", 1, NULL, 0x108},
+        {"perf-counters", 0, NULL, 0x109},
+        {"max-skipped-relocs", 1, NULL, 0x10a},
+        {"max-unresolved-relocs", 1, NULL, 0x10b},
+        {"huge-pages", 0, NULL, 0x10c},
+        {"window", 1, NULL, 0x10d},
         {nullptr, 0, nullptr, 0}
 };
 void useage();
 
+// Physical memory of the machine, 0 if unknown.
+static size_t PhysicalMemory() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    auto pages = sysconf(_SC_PHYS_PAGES);
+    auto page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0) {
+        return (size_t)pages * (size_t)page_size;
+    }
+#endif
+    return 0;
+}
 
-bool main_loop(int argc, char* argv[]) {
+// Returns the process exit code, -1 for bad arguments.
+int main_loop(int argc, char* argv[]) {
     int c;
 
-    ObElfReader elf_reader;
-
-    std::string source, output, baseso;
+    FixOptions options;
+    std::string batch, serve, cache_dir, page_store_dir, restore, stats_json, trace;
+    bool perf_counters = false;
+    unsigned jobs = 0;
+    size_t mem_budget = PhysicalMemory();
     while((c = getopt_long(argc, argv, short_options, long_options, nullptr)) != -1) {
         switch (c) {
             case 'd':
+                FLogSetLevel(FLOG_LEVEL_DEBUG);
                 FLOGI("Use debug mode");
                 break;
             case 's':
-                source = optarg;
+                options.source = optarg;
                 break;
             case 'o':
-                output = optarg;
+                options.output = optarg;
                 break;
             case 'b':
-                baseso = optarg;
-                break;
-            case 'm': {
-                auto is16Bit = [](const char* c) {
-                    auto len = strlen(c);
-                    if(len > 2) {
-                        if(c[0] == '0' & c[1] == 'x') return true;
-                    }
-                    bool is10bit = true;
-                    for(auto i = 0; i < len; i++) {
-                        if((c[i] > 'a' && c[i] < 'f') ||
-                           (c[i] > 'A' && c[i] < 'F')) {
-                            is10bit = false;
-                        }
-                    }
-                    return !is10bit;
-                };
-#ifndef __SO64__
-                auto base = strtoul(optarg, 0, is16Bit(optarg) ? 16: 10);
-#else
-                auto base = strtoull(optarg, 0, is16Bit(optarg) ? 16: 10);
-#endif
-                elf_reader.setDumpSoBaseAddr(base);
-            }
+                options.baseso = optarg;
+                break;
+            case 'c':
+                options.compact = true;
+                break;
+            case 'B':
+                batch = optarg;
+                break;
+            case 'j':
+                jobs = strtoul(optarg, 0, 10);
+                break;
+            case 'M':
+                if (!ParseSize(optarg, &mem_budget)) {
+                    FLOGE("bad size of -M: %s", optarg);
+                    return -1;
+                }
+                break;
+            case 'S':
+                serve = optarg;
+                break;
+            case 0x100:
+                options.source_fd = strtol(optarg, 0, 10);
+                if (options.source.empty()) {
+                    options.source = "fd:" + std::string(optarg);
+                }
+                break;
+            case 0x101:
+                options.output_fd = strtol(optarg, 0, 10);
+                break;
+            case 0x102:
+                cache_dir = optarg;
+                break;
+            case 0x103:
+                page_store_dir = optarg;
+                break;
+            case 0x104:
+                restore = optarg;
+                break;
+            case 0x105:
+                options.previous = optarg;
+                break;
+            case 0x106:
+                options.save_refix = true;
+                break;
+            case 0x107:
+                stats_json = optarg;
+                break;
+            case 0x108:
+                trace = optarg;
+                break;
+            case 0x109:
+                perf_counters = true;
+                break;
+            case 0x10a:
+                options.max_skipped_relocs = strtod(optarg, nullptr);
+                break;
+            case 0x10b:
+                options.max_unresolved_relocs = strtod(optarg, nullptr);
+                break;
+            case 0x10c:
+                options.huge_pages = true;
+                break;
+            case 0x10d:
+                if (!ParseSize(optarg, &options.window_size)) {
+                    FLOGE("bad size of --window: %s", optarg);
+                    return -1;
+                }
+                break;
+            case 'm':
+                options.dump_base = ParseDumpBase(optarg);
                 break;
             default:
-                return false;
+                return -1;
         }
     }
 
-    auto file = fopen(source.c_str(), "rb");
-    if(nullptr == file) {
-        FLOGE("source so file cannot found!!!");
-        return false;
+    std::unique_ptr<ResultCache> result_cache;
+    if (!cache_dir.empty()) {
+        result_cache.reset(new ResultCache(cache_dir));
+        if (!result_cache->Init()) {
+            return 1;
+        }
+        options.result_cache = result_cache.get();
     }
-#ifdef __LARGE64_FILES
-    auto fd = file->_file;
-#else
-    auto fd = fileno(file);
-#endif
 
-    FLOGI("start to rebuild elf file");
-    if (!elf_reader.setSource(source.c_str())) {
-        FLOGE("unable to open source file");
-        return false;
-    }
-    if (!baseso.empty()) {
-        elf_reader.setBaseSoName(baseso.c_str());
+    std::unique_ptr<PageStore> page_store;
+    if (!page_store_dir.empty()) {
+        page_store.reset(new PageStore(page_store_dir));
+        if (!page_store->Init()) {
+            return 1;
+        }
+        options.page_store = page_store.get();
     }
 
-    if(!elf_reader.Load()) {
-        FLOGE("source so file is invalid");
-        return false;
+    if (!restore.empty()) {
+        if (page_store == nullptr || (options.output.empty() && options.output_fd < 0)) {
+            FLOGE("page store and output are required to restore %s", restore.c_str());
+            return -1;
+        }
+        return RestoreSoFile(options, restore) ? 0 : 1;
     }
 
-    ElfRebuilder elf_rebuilder(&elf_reader);
-    if(!elf_rebuilder.Rebuild()) {
-        FLOGE("error occured in rebuilding elf file");
-        return false;
+    if (perf_counters) {
+        if (stats_json.empty()) {
+            FLOGW("performance counters are only written with --stats-json");
+        } else {
+            EnablePerfCounters();
+        }
+    }
+    if (!trace.empty() && !StartTrace(trace.c_str())) {
+        return 1;
+    }
+    TraceThreadName("main");
+    auto start = WallTime();
+    if (!serve.empty()) {
+        if (!stats_json.empty()) {
+            FLOGW("stats json is not written in serve mode");
+        }
+        // -m -b -c are used as default options for all requests
+        FixServer server(options, jobs);
+        return server.Serve(serve.c_str()) ? 0 : 1;
     }
-    fclose(file);
 
-    if (!output.empty()) {
-        file = fopen(output.c_str(), "wb+");
-        if(nullptr == file) {
-            FLOGE("output so file cannot write !!!");
-            return false;
+    if (!batch.empty()) {
+        // -m -b -c are used as default options for all jobs
+        BatchRunner runner(options, jobs);
+        runner.setMemoryBudget(mem_budget);
+        struct stat st;
+        if (stat(batch.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (options.output.empty()) {
+                FLOGE("output directory is required to fix a directory");
+                return -1;
+            }
+            if (!runner.LoadDirectory(batch.c_str(), options.output.c_str())) {
+                return -1;
+            }
+        } else if (!runner.LoadManifest(batch.c_str())) {
+            return -1;
+        }
+        runner.setCollectStats(!stats_json.empty());
+        auto failed = runner.Run();
+        if (!stats_json.empty()) {
+            WriteStatsJson(stats_json.c_str(), runner.stats(), WallTime() - start);
         }
-        fwrite(elf_rebuilder.getRebuildData(), 1, elf_rebuilder.getRebuildSize(),  file);
-        fclose(file);
+        return failed == 0 ? 0 : 1;
     }
 
-    return true;
+    if (options.source.empty()) {
+        FLOGE("source so file cannot found!!!");
+        return -1;
+    }
+    std::vector<FixStats> stats(stats_json.empty() ? 0 : 1);
+    if (!stats.empty()) {
+        stats[0].source = options.source;
+        stats[0].output = options.output;
+        options.stats = &stats[0];
+    }
+    // batch and serve mode have their own pool
+    std::unique_ptr<ImagePool> image_pool;
+    if (options.huge_pages) {
+        image_pool.reset(new ImagePool(0));
+        image_pool->setHugePages(true);
+        options.image_pool = image_pool.get();
+    }
+    auto ok = FixSoFile(options);
+    if (!stats.empty()) {
+        stats[0].ok = ok;
+        WriteStatsJson(stats_json.c_str(), stats, WallTime() - start);
+    }
+    return ok ? 0 : -1;
 }
 
 int main(int argc, char* argv[]) {
-    if (main_loop(argc, argv)) {
+    FLogStartAsync();
+    auto rc = main_loop(argc, argv);
+    StopTrace();
+    if (rc == 0) {
         FLOGI("Done!!!");
-        return 0;
+    } else if (rc < 0) {
+        useage();
     }
-    useage();
-    return -1;
+    FLogStopAsync();
+    return rc;
 }
 
 void useage() {
-    FLOGI(TARGET_NAME "v2.1 author F8LEFT(currwin)");
+    FLOGI(TARGET_NAME "v" SOFIXER_VERSION " author F8LEFT(currwin)");
     FLOGI("Useage: SoFixer <option(s)> -s sourcefile -o generatefile");
+    FLOGI("        SoFixer <option(s)> -B manifest|sourceDir [-o generateDir]");
+    FLOGI("        SoFixer <option(s)> -S socketPath");
     FLOGI(" try rebuild shdr with phdr");
     FLOGI(" Options are:");
 
@@ -138,5 +281,24 @@ void useage() {
     FLOGI("  -s --source sourceFilePath                 Source file path");
     FLOGI("  -b --baseso baseFilePath                   Original so file path.(used to get base information)(experimental)");
     FLOGI("  -o --output generateFilePath               Generate file path");
+    FLOGI("  -c --compact                               Pack segments in file instead of p_offset = p_vaddr");
+    FLOGI("  -B --batch manifest|sourceDir              Fix many files, manifest line: source output [memBaseAddr] [baseso]");
+    FLOGI("  -j --jobs count                            Worker count in batch and serve mode(default: cpu count)");
+    FLOGI("  -M --mem-budget size(K/M/G)                Memory used by running jobs in batch mode(default: physical memory, 0 for no limit)");
+    FLOGI("     --max-skipped-relocs percent            Fail if more relocations are skipped for unknown type");
+    FLOGI("     --max-unresolved-relocs percent         Fail if more relocations point to symbols not in the library");
+    FLOGI("     --huge-pages                            Back loaded and rebuilt images of 2MB or more with transparent huge pages");
+    FLOGI("     --window size(K/M/G)                    Map the dump and rebuild it in windows of size, for dumps larger than memory(needs -m)");
+    FLOGI("     --source-fd fd                          Read source from inherited file descriptor(e.g. memfd)");
+    FLOGI("     --output-fd fd                          Write output to inherited file descriptor");
+    FLOGI("     --cache-dir dir                         Reuse outputs of the same source and options stored in dir");
+    FLOGI("     --page-store dir                        Also keep outputs as deduplicated pages in dir, named after output file");
+    FLOGI("     --restore outputPath                    Reassemble output fixed to outputPath from page store to -o");
+    FLOGI("     --refix-data                            Save output.refix, so that later dumps can be fixed with --previous");
+    FLOGI("     --previous fixedFilePath                Only fix pages changed since the previous output of the same library");
+    FLOGI("     --stats-json path                       Write time of every phase and counters of jobs to path as json");
+    FLOGI("     --perf-counters                         Also count cycles, instructions, llc/dtlb misses and page faults of phases in stats json");
+    FLOGI("     --trace path                            Write trace events of jobs and phases for chrome://tracing or perfetto");
+    FLOGI("  -S --serve socketPath                      Fix requests from unix domain socket, request line: source output [memBaseAddr] [baseso]");
     FLOGI("  -h --help                                  Display this information");
 }
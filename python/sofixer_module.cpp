@@ -0,0 +1,134 @@
+//===------------------------------------------------------------*- C++ -*-===//
+//
+//===----------------------------------------------------------------------===//
+// Python binding of libsofixer
+//
+//   import sofixer64
+//   image = sofixer64.fix(idaapi.dbg_read_memory(start, size), base=start)
+//   open('fix.so', 'wb').write(image)
+//
+// The dump is read through the buffer protocol without copy, and the fixed
+// image is returned as an object exporting the buffer protocol.
+//===----------------------------------------------------------------------===//
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "Fixer.h"
+
+#ifdef __SO64__
+#define MODULE_NAME "sofixer64"
+#define MODULE_INIT PyInit_sofixer64
+#else
+#define MODULE_NAME "sofixer32"
+#define MODULE_INIT PyInit_sofixer32
+#endif
+
+struct FixedImageObject {
+    PyObject_HEAD
+    FixBuffer* buffer;
+};
+
+static void FixedImage_dealloc(FixedImageObject* self) {
+    delete self->buffer;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int FixedImage_getbuffer(FixedImageObject* self, Py_buffer* view, int flags) {
+    return PyBuffer_FillInfo(view, (PyObject*)self, self->buffer->data.get(),
+                             self->buffer->size, 0, flags);
+}
+
+static Py_ssize_t FixedImage_length(FixedImageObject* self) {
+    return self->buffer->size;
+}
+
+static PyBufferProcs FixedImage_as_buffer = {
+        (getbufferproc)FixedImage_getbuffer,
+        nullptr,
+};
+
+static PySequenceMethods FixedImage_as_sequence = {
+        (lenfunc)FixedImage_length,
+};
+
+static PyTypeObject FixedImageType = {
+        PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+static PyObject* sofixer_fix(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"dump", "base", "baseso", "compact", "name", nullptr};
+    Py_buffer dump;
+    unsigned long long base = 0;
+    const char* baseso = nullptr;
+    int compact = 0;
+    const char* name = nullptr;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|Kzpz", (char**)keywords,
+                                     &dump, &base, &baseso, &compact, &name)) {
+        return nullptr;
+    }
+
+    FixOptions options;
+    options.dump_base = (Elf_Addr)base;
+    options.compact = compact != 0;
+    if (baseso != nullptr) {
+        options.baseso = baseso;
+    }
+    if (name != nullptr) {
+        options.source = name;
+    }
+
+    auto buffer = new FixBuffer;
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = FixSoBuffer(dump.buf, dump.len, options, buffer);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&dump);
+    if (!ok) {
+        delete buffer;
+        PyErr_SetString(PyExc_ValueError, "unable to fix the dumped so");
+        return nullptr;
+    }
+
+    auto image = PyObject_New(FixedImageObject, &FixedImageType);
+    if (image == nullptr) {
+        delete buffer;
+        return nullptr;
+    }
+    image->buffer = buffer;
+    return (PyObject*)image;
+}
+
+static PyMethodDef sofixer_methods[] = {
+        {"fix", (PyCFunction)(void(*)(void))sofixer_fix, METH_VARARGS | METH_KEYWORDS,
+         "fix(dump, base=0, baseso=None, compact=False, name=None)\n"
+         "Fix a so dumped from memory at base, returns the fixed image as a buffer."},
+        {nullptr, nullptr, 0, nullptr}
+};
+
+static struct PyModuleDef sofixer_module = {
+        PyModuleDef_HEAD_INIT,
+        MODULE_NAME,
+        "Fix so file dumped from memory.",
+        -1,
+        sofixer_methods,
+};
+
+PyMODINIT_FUNC MODULE_INIT(void) {
+    FixedImageType.tp_name = MODULE_NAME ".FixedImage";
+    FixedImageType.tp_basicsize = sizeof(FixedImageObject);
+    FixedImageType.tp_dealloc = (destructor)FixedImage_dealloc;
+    FixedImageType.tp_as_buffer = &FixedImage_as_buffer;
+    FixedImageType.tp_as_sequence = &FixedImage_as_sequence;
+    FixedImageType.tp_flags = Py_TPFLAGS_DEFAULT;
+    FixedImageType.tp_doc = "Fixed so image, exports the buffer protocol.";
+    if (PyType_Ready(&FixedImageType) < 0) {
+        return nullptr;
+    }
+
+    auto module = PyModule_Create(&sofixer_module);
+    if (module == nullptr) {
+        return nullptr;
+    }
+    Py_INCREF(&FixedImageType);
+    PyModule_AddObject(module, "FixedImage", (PyObject*)&FixedImageType);
+    return module;
+}